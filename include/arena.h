@@ -0,0 +1,35 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <stddef.h>
+
+#include "mytypes.h"
+
+#define ARENA_BLOCK_SIZE 1024
+
+typedef struct st_ArenaBlock
+{
+    struct st_ArenaBlock* next;
+    size_t size, used;
+    _Alignas(max_align_t) char data[];
+} st_ArenaBlock;
+
+typedef st_ArenaBlock* ArenaBlock;
+
+typedef struct st_Arena
+{
+    ArenaBlock head;
+    size_t refs;
+} st_Arena;
+
+typedef st_Arena* Arena;
+
+Arena arena_create(size_t blocksize);
+
+void* arena_alloc(Arena a, size_t size);
+char* arena_strndup(Arena a, const char* s, size_t n);
+
+Arena arena_retain(Arena a);
+void arena_release(Arena a);
+
+#endif
\ No newline at end of file
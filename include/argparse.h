@@ -1,20 +1,52 @@
 #ifndef __ARGPARSE__
 #define __ARGPARSE__
 
+#include <stdint.h>
+
 #include "mytypes.h"
 
+#define ARG_MAX_POSIT 8
+
+/*
+Flags are single alphanumeric characters, each mapped to one bit of a 64 bit
+mask: a-z to bits 0-25, A-Z to 26-51 and 0-9 to 52-61. Bit 63 is never part
+of a spec and stands for "not a valid flag character".
+*/
+#define ARG_BIT(c) (((c) >= 'a' && (c) <= 'z') ? (c)-'a' :\
+                    ((c) >= 'A' && (c) <= 'Z') ? (c)-'A'+26 :\
+                    ((c) >= '0' && (c) <= '9') ? (c)-'0'+52 : 63)
+#define ARG_FLAG(c) (1ULL << ARG_BIT(c))
+
+/*
+Compiled option spec of a builtin, meant to be declared static const.
+flags holds the boolean flags (passed to signify true, omitted for false).
+addflags holds the flags which require an additional argument, assumed to be
+the very next argument.
+num_posit is the maximum number of positional arguments; the first non-flag
+argument is positional argument 0, the second is 1, and so on.
+*/
+typedef struct st_ArgSpec {
+    uint64_t flags;
+    uint64_t addflags;
+    size_t num_posit;
+} st_ArgSpec;
+
+typedef const st_ArgSpec* ArgSpec;
+
+// Result of parsing argv against a spec. Values point into argv.
 typedef struct st_ArgTable{
-    Vector args;
-    Vector values;
+    ArgSpec spec;
+    uint64_t flags;
+    size_t num_posit;
+    char* addargs[64];
+    char* posargs[ARG_MAX_POSIT];
 } st_ArgTable;
 
 typedef st_ArgTable* ArgTable;
 
-ArgTable parse_args(String options, Vector argv);
+errcode_t parse_args(ArgSpec spec, Vector argv, ArgTable argtab);
 bool_t argtable_is_flag_set(ArgTable argtab, char flag);
-String argtable_get_add_arg(ArgTable argtab, char flag);
-String argtable_get_pos_arg(ArgTable argtab, char* posarg);
-
-void argtable_delete(ArgTable argtab);
+char* argtable_get_add_arg(ArgTable argtab, char flag);
+char* argtable_get_pos_arg(ArgTable argtab, size_t idx);
 
 #endif
\ No newline at end of file
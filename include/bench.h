@@ -0,0 +1,40 @@
+#ifndef __BENCH__
+#define __BENCH__
+
+#include <stdint.h>
+
+#include "mytypes.h"
+
+#define BENCH_DEFAULT_RUNS 10
+#define BENCH_DEFAULT_WARMUPS 1
+#define BENCH_MAX_RUNS 100000
+#define BENCH_SEPARATOR "--"
+
+// One measured run of a command line: monotonic wall time, and the CPU
+// time of its processes in microseconds.
+typedef struct st_BenchRun
+{
+    int64_t real_ns;
+    uint64_t user, sys;
+} st_BenchRun;
+
+typedef st_BenchRun* BenchRun;
+
+/*
+One or two command lines, each run warmups times unmeasured and then runs
+times into results. With two, runs alternate between them so that drift in
+the machine's state affects both alike.
+*/
+typedef struct st_Bench
+{
+    String cmds[2];
+    size_t ncmds, runs, warmups;
+    BenchRun results[2];
+} st_Bench;
+
+typedef st_Bench* Bench;
+
+bool_t bench_run(ShellData sd, Bench b);
+void bench_report(Bench b);
+
+#endif
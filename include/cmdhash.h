@@ -0,0 +1,48 @@
+#ifndef __CMDHASH__
+#define __CMDHASH__
+
+#include <time.h>
+
+#include "mytypes.h"
+
+#define CMDHASH_MIN_CAP 64
+#define CMDHASH_DEFAULT_PATH "/bin:/usr/bin"
+#define CMDHASH_RECHECK_MS 1000
+
+// path is NULL for a name that no PATH directory holds.
+typedef struct st_CmdHashEntry
+{
+    char* name;
+    char* path;
+    size_t hits;
+} st_CmdHashEntry;
+
+typedef st_CmdHashEntry* CmdHashEntry;
+
+// Open addressing table of command names, valid for the PATH value in path
+// and the directory mtimes last checked at checked_at (CLOCK_MONOTONIC).
+typedef struct st_CmdHash
+{
+    CmdHashEntry entries;
+    size_t cap, used;
+    char* path;
+    char** dirs;
+    struct timespec* mtimes;
+    size_t ndirs;
+    struct timespec checked_at;
+    bool_t checked, relative;
+} st_CmdHash;
+
+typedef st_CmdHash* CmdHash;
+
+CmdHash cmdhash_create();
+void cmdhash_delete(CmdHash h);
+
+void cmdhash_clear(CmdHash h);
+void cmdhash_expire(CmdHash h);
+
+const char* cmdhash_lookup(CmdHash h, const char* name);
+const char* cmdhash_rehash(CmdHash h, const char* name);
+void cmdhash_print(CmdHash h);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __HISTORY__
+#define __HISTORY__
+
+#include <stdint.h>
+
+#include "mytypes.h"
+
+#define HISTORY_MAGIC 0x32485359        // "YSH2"
+#define HISTORY_INDEX_MAGIC 0x49485359  // "YSHI"
+#define HISTORY_VERSION 4
+
+#define HISTORY_DATA_START 64
+#define HISTORY_MIN_SIZE (64*1024)
+#define HISTORY_LOG_SHOWN 15
+#define HISTORY_SEARCH_MAX 64
+
+#define HISTORY_BUCKETS 65536
+#define HISTORY_CHUNK_ENTRIES 28
+#define HISTORY_INDEX_START (HISTORY_DATA_START + sizeof(st_HistoryBucket)*HISTORY_BUCKETS)
+
+// The data file is only ever appended to, so its size is the end of the last
+// record. Entries before start have been purged.
+typedef struct st_HistoryHeader
+{
+    uint32_t magic, version;
+    uint64_t start;
+    uint64_t count;
+} st_HistoryHeader;
+
+typedef st_HistoryHeader* HistoryHeader;
+
+// Records are 8-byte aligned and end with a uint64_t copy of size, so the
+// file can be walked backwards from its end. Times are in microseconds.
+typedef struct st_HistoryRecord
+{
+    uint32_t size, len;
+    int64_t start;
+    uint64_t wall, user, sys;
+    int32_t status;  // exit code, 128+signal if killed, -1 if still running
+    uint32_t cwdlen;
+    char text[];    // the command, then the cwd it ran in
+} st_HistoryRecord;
+
+typedef st_HistoryRecord* HistoryRecord;
+
+typedef struct st_HistoryIndexHeader
+{
+    uint32_t magic, version;
+    uint64_t indexed;
+    uint64_t end;
+} st_HistoryIndexHeader;
+
+typedef st_HistoryIndexHeader* HistoryIndexHeader;
+
+typedef struct st_HistoryBucket
+{
+    uint64_t head, count;
+} st_HistoryBucket;
+
+typedef st_HistoryBucket* HistoryBucket;
+
+// Record offsets are stored in 8-byte units, which addresses 32 GB of history.
+typedef struct st_HistoryChunk
+{
+    uint64_t next;
+    uint32_t n, pad;
+    uint32_t offs[HISTORY_CHUNK_ENTRIES];
+} st_HistoryChunk;
+
+typedef st_HistoryChunk* HistoryChunk;
+
+typedef struct st_MappedFile
+{
+    fd_t fd;
+    char* base;
+    size_t size;
+} st_MappedFile;
+
+typedef st_MappedFile* MappedFile;
+
+typedef struct st_History
+{
+    st_MappedFile data, index;
+} st_History;
+
+typedef st_History* History;
+
+History history_open(const char* path);
+void history_close(History h);
+
+size_t history_count(History h);
+uint64_t history_begin(History h);
+uint64_t history_end(History h);
+uint64_t history_prev(History h, uint64_t end);
+uint64_t history_older(History h, uint64_t off);
+HistoryRecord history_record(History h, uint64_t off);
+char* history_text(History h, uint64_t off, size_t* len);
+char* history_cwd(History h, uint64_t off, size_t* len);
+char* history_get(History h, size_t idx, size_t* len);
+void history_append(History h, HistoryRecord meta, const char* cmd, size_t len, const char* cwd, size_t cwdlen);
+void history_clear(History h);
+
+void history_index_update(History h);
+size_t history_search(History h, const char* query, size_t qlen, uint64_t* results, size_t max);
+
+#endif
@@ -1,15 +1,63 @@
 #ifndef __COMMAND__
 #define __COMMAND__
 
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+
 #include "mytypes.h"
+#include "tokenizer.h"
+
+// Resources used by a process or job, from wait4 once it has exited and
+// from /proc while it runs. CPU times are in microseconds, maxrss in KiB.
+typedef struct st_ResUsage
+{
+    uint64_t user, sys;
+    long maxrss, majflt, nvcsw, nivcsw;
+} st_ResUsage;
+
+typedef st_ResUsage* ResUsage;
+
+// Report requested by a leading "time" (human) or "time -m" (key=value lines).
+typedef enum {
+    JOB_TIME_NONE,
+    JOB_TIME_HUMAN,
+    JOB_TIME_MACHINE
+} jobtime_t;
+
+// Whether a job is demoted while in the background. JOB_PRIO_DEFAULT
+// follows the shell-wide setting, the others come from a "prio" prefix.
+typedef enum {
+    JOB_PRIO_DEFAULT,
+    JOB_PRIO_BATCH,
+    JOB_PRIO_NORMAL
+} jobprio_t;
+
+// Scheduling policy, nice value and raw I/O priority of a thread.
+typedef struct st_SchedPrio
+{
+    int policy, nice, ioprio;
+} st_SchedPrio;
+
+typedef st_SchedPrio* SchedPrio;
+
+#define JOB_DEMOTE_NICE 0
 
 typedef struct st_Process
 {
     Vector argv;
+    char* line;
+    Token args;
+    size_t argc;
     pid_t pid;
     bool_t is_done, is_stopped, append;
     int status;
-    char *in, *out, *err;
+    st_Token in, out, err;
+    Arena arena;
+    Job job;
+    st_ResUsage usage;
+    // CLOCK_MONOTONIC launch time, and the time it was seen to exit.
+    struct timespec started, finished;
 } st_Process;
 
 typedef st_Process* Process;
@@ -19,55 +67,106 @@ typedef struct st_Job
     String command;
     Vector procs;
     pid_t pgid;
-    bool_t have_notified, is_bg;
+    bool_t have_notified, is_bg, has_changed;
+    // Only an interactive shell gives each job its own process group. In
+    // batch mode pgid is just the first process's pid.
+    bool_t own_pgrp;
     struct termios* tmodes;
+    Arena arena;
+    st_ResUsage usage;  // summed over the job's exited processes
+    jobtime_t timing;
+    struct timespec started;
+    // CPUs the job's processes are confined to when is_pinned is set.
+    bool_t is_pinned;
+    cpu_set_t cpus;
+    // While is_demoted, saved holds what the job had before and gets back
+    // in the foreground.
+    jobprio_t prio;
+    bool_t is_demoted;
+    st_SchedPrio saved;
+    // Slot in the last list the job was added to, the shell's job list
+    // once it has been launched.
+    size_t slot;
 } st_Job;
 
 typedef st_Job* Job;
 
-typedef struct st_JobListNode
+// Open addressing map from a pid or pgid to a process or job.
+typedef struct st_PidMap
 {
-    Job job;
-    struct st_JobListNode *next, *prev;
-} st_JobListNode;
-
-typedef st_JobListNode* JobListNode;
-
+    pid_t* keys;
+    void** vals;
+    size_t cap, used;
+} st_PidMap;
+
+/*
+Jobs live in insertion order in slots[0..nslots). Removed jobs leave a NULL
+hole until holes outnumber live jobs and the array is compacted, so walk it
+skipping NULLs. pgids maps each job's pgid and pids each launched process.
+*/
 typedef struct st_JobList
 {
-    size_t size;
-    JobListNode sentinel;
+    Job* slots;
+    size_t size, nslots, cap;
+    Arena arena;
+    String line;
+    st_PidMap pids, pgids;
+    Vector changed;
 } st_JobList;
 
 typedef st_JobList* JobList;
 
-Process process_create(Vector argv);
-Job job_create(String command, Vector procs);
+Process process_create(Arena a, char* line, Token args, size_t argc);
+Job job_create(Arena a, String command, Vector procs);
 JobList joblist_create();
 
 void process_delete(Process p);
+
+bool_t process_name_is(Process p, const char* name);
+int process_exit_code(Process p);
+char* process_get_cstr(Process p, Token span);
+char** process_get_argv(Process p);
 void job_delete(Job j);
 void joblist_delete(JobList jl, bool_t deljobs);
-void joblistnode_delete(JobListNode node, bool_t deljob);
 
 void joblist_add_job(JobList jl, Job j);
+Job joblist_last(JobList jl);
 Job joblist_find_job(JobList jl, pid_t pgid);
-void joblist_pop_node(JobList jl, JobListNode node);
-void joblist_delete_node(JobList jl, JobListNode node);
+Process joblist_find_process(JobList jl, pid_t pid);
+void joblist_remove_job(JobList jl, Job j);
+void joblist_delete_job(JobList jl, Job j);
 bool_t joblist_check_cmd(JobList jl, char* cmd);
 
-void job_mv_to_bg(Job j, bool_t cont);
+void job_mv_to_bg(ShellData sd, Job j, bool_t cont);
 void job_mv_to_fg(ShellData sd, Job j, bool_t cont);
 bool_t job_continue(ShellData sd, pid_t pgid, bool_t isfg);
 
 bool_t job_is_stopped(Job j);
 bool_t job_is_done(Job j);
 
-void job_update(Job j);
+void jobctrl_init_reaper();
+void jobctrl_reset_reaper();
+
 void job_wait(Job j);
+void joblist_mark_changed(JobList jl, Job j);
 void joblist_update(JobList jl);
 void joblist_kill_all(JobList jl);
 
+void resusage_add(ResUsage total, ResUsage u);
+void job_get_usage(Job j, ResUsage u);
+void resusage_append(StringBuilder sb, ResUsage u, bool_t verbose);
+bool_t cpuset_parse(const char* s, cpu_set_t* set);
+void cpuset_append(StringBuilder sb, cpu_set_t* set);
+int pgrp_set_affinity(pid_t pgid, cpu_set_t* set);
+bool_t job_get_affinity(Job j, cpu_set_t* set);
+bool_t job_get_prio(Job j, SchedPrio prio);
+void schedprio_append(StringBuilder sb, SchedPrio prio);
+void job_demote(ShellData sd, Job j, bool_t running);
+void job_restore_prio(Job j);
+
+int64_t timespec_diff_ns(struct timespec* start, struct timespec* stop);
+void job_report_time(Job j);
+
 void process_print(Process p);
 void job_print(Job j);
 void joblist_print(JobList jl);
@@ -3,6 +3,7 @@
 
 #include "mytypes.h"
 
+void run_job(ShellData sd, Job j);
 void run_jobs(ShellData sd, JobList newjobs);
 
 #endif
\ No newline at end of file
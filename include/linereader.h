@@ -0,0 +1,26 @@
+#ifndef __LINEREADER__
+#define __LINEREADER__
+
+#include "mytypes.h"
+
+#define LINEREADER_BUFLEN 4096
+
+typedef struct st_LineReader
+{
+    fd_t fd;
+    char* buf;
+    size_t buflen, start, end;
+    bool_t eof;
+} st_LineReader;
+
+typedef st_LineReader* LineReader;
+
+LineReader linereader_create(fd_t fd, size_t buflen);
+LineReader linereader_create_str(char* s);
+
+errcode_t linereader_next(LineReader lr, char** line, size_t* len);
+bool_t linereader_has_line(LineReader lr);
+
+void linereader_delete(LineReader lr);
+
+#endif
\ No newline at end of file
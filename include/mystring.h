@@ -3,20 +3,43 @@
 
 #include "mytypes.h"
 
+// Strings that fit here (with their terminator) never touch the heap.
+#define STRING_SSO_LEN 23
+
+/*
+len is the exact length of cstr, measured from the start of the buffer and
+not from offset, and every mutator keeps it current.
+*/
 typedef struct st_String
 {
     char* cstr;
     size_t buflen;
     size_t len;
     size_t offset;
-    bool_t dirty;
+    char sso[STRING_SSO_LEN+1];
 } st_String;
 
 typedef st_String* String;
 
+#define STRBUILDER_MIN_CAP 32
+
+/*
+Growable buffer for assembling a String piecewise. Builders usually live on
+the stack; strbuilder_finish hands the buffer to a new String without
+copying it.
+*/
+typedef struct st_StringBuilder
+{
+    char* buf;
+    size_t len, cap;
+} st_StringBuilder;
+
+typedef st_StringBuilder* StringBuilder;
+
 String string_create(char* cstr, size_t buflen);
 String string_create_copy(String s);
 String string_create_copyc(char* s);
+String string_create_arena(Arena a, char* s, size_t n);
 
 errcode_t string_set_offset(String s, size_t off);
 void string_set_equal(String s1, String s2);
@@ -36,12 +59,13 @@ bool_t string_is_equal(String s1, String s2);
 bool_t string_is_equalc(String s1, char* s2);
 bool_t string_has_csubstr(String s, char* sub);
 
-String string_substr_abs(String s, size_t start, size_t offt);
-char* string_subcstr_abs(String s, size_t start, size_t offt);
-
-String string_add(String s1, String s2);
-String string_addc(String s1, char* s2);
-
 void string_delete(String s);
 
+void strbuilder_init(StringBuilder sb, size_t cap);
+void strbuilder_append(StringBuilder sb, String s);
+void strbuilder_append_cstr(StringBuilder sb, const char* s);
+void strbuilder_append_cstrn(StringBuilder sb, const char* s, size_t n);
+void strbuilder_append_fmt(StringBuilder sb, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+String strbuilder_finish(StringBuilder sb);
+
 #endif
\ No newline at end of file
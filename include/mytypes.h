@@ -25,18 +25,30 @@ typedef char bool_t;
 typedef struct st_ShellData st_ShellData;
 typedef struct st_Vector st_Vector;
 typedef struct st_String st_String;
+typedef struct st_StringBuilder st_StringBuilder;
 typedef struct st_Process st_Process;
 typedef struct st_Job st_Job;
-typedef struct st_JobListNode st_JobListNode;
 typedef struct st_JobList st_JobList;
+typedef struct st_Arena st_Arena;
+typedef struct st_Token st_Token;
+typedef struct st_Tokenizer st_Tokenizer;
+typedef struct st_LineReader st_LineReader;
+typedef struct st_History st_History;
+typedef struct st_CmdHash st_CmdHash;
 
 typedef st_ShellData* ShellData;
 typedef st_Vector* Vector;
 typedef st_String* String;
+typedef st_StringBuilder* StringBuilder;
 typedef st_Process* Process;
 typedef st_Job* Job;
-typedef st_JobListNode* JobListNode;
 typedef st_JobList* JobList;
+typedef st_Arena* Arena;
+typedef st_Token* Token;
+typedef st_Tokenizer* Tokenizer;
+typedef st_LineReader* LineReader;
+typedef st_History* History;
+typedef st_CmdHash* CmdHash;
 
 struct termios;
 
@@ -0,0 +1,41 @@
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+#include "mytypes.h"
+
+#define PARALLEL_PLACEHOLDER "{}"
+#define PARALLEL_SEPARATOR ":::"
+#define PARALLEL_MAX_JOBS 4096
+
+typedef struct st_ParallelSlot
+{
+    pid_t pid;
+    size_t arg;
+    fd_t out, err;
+} st_ParallelSlot;
+
+typedef st_ParallelSlot* ParallelSlot;
+
+/*
+One fan-out: the command template is run once per argument, with every {}
+in it replaced by the argument, or the argument appended when the template
+has no {}. At most maxjobs commands run at once. With group set, each
+command's output is held back until it exits so lines never interleave.
+*/
+typedef struct st_Parallel
+{
+    char** tmpl;
+    size_t ntmpl;
+    Vector args;
+    size_t maxjobs;
+    bool_t group, null_stdin;
+    ParallelSlot slots;
+    size_t running, done, failed;
+} st_Parallel;
+
+typedef st_Parallel* Parallel;
+
+size_t parallel_default_jobs();
+void parallel_run(ShellData sd, Parallel par);
+
+#endif
@@ -10,10 +10,12 @@ typedef struct st_parser_ret {
 
 bool_t is_whitespace(char c);
 
-String get_input();
+String get_input(ShellData sd);
 void parse_whitespace(String input);
-st_parser_ret parse_process(String input);
-st_parser_ret parse_job(String input);
+st_parser_ret parse_process(Tokenizer tz, Arena a);
+st_parser_ret parse_job(Tokenizer tz, Arena a);
+errcode_t parse_line(JobList jl, String input);
 JobList parse_input(ShellData sd, String input);
+JobList parse_batch(ShellData sd);
 
 #endif
\ No newline at end of file
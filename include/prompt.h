@@ -6,6 +6,8 @@
 String get_username();
 String get_hostname();
 String get_path();
+String prompt_get_cwd(ShellData sd);
+void prompt_invalidate(ShellData sd);
 void display_prompt(ShellData sd);
 
 #endif
\ No newline at end of file
@@ -8,11 +8,11 @@ typedef void (*shellcmd_func)(ShellData sd, Process p);
 typedef struct st_shellcmd {
     shellcmd_func cmd_func;
     char* cmd_name;
+    bool_t is_forced, is_pipeable;
 } st_shellcmd;
 
-
-shellcmd_func is_shellcmd(Process p);
-shellcmd_func is_forced_shellcmd(Process p);
+const st_shellcmd* shellcmd_lookup(const char* name, size_t len);
+const st_shellcmd* shellcmd_find(Process p);
 
 void cmd_hop(ShellData sd, Process p);
 void cmd_reveal(ShellData sd, Process p);
@@ -25,5 +25,10 @@ void cmd_fg(ShellData sd, Process p);
 void cmd_bg(ShellData sd, Process p);
 void cmd_neonate(ShellData sd, Process p);
 void cmd_iMan(ShellData sd, Process p);
+void cmd_hash(ShellData sd, Process p);
+void cmd_parallel(ShellData sd, Process p);
+void cmd_bench(ShellData sd, Process p);
+void cmd_pin(ShellData sd, Process p);
+void cmd_prio(ShellData sd, Process p);
 
 #endif
\ No newline at end of file
@@ -1,15 +1,30 @@
 #ifndef __SHELLDATA__
 #define __SHELLDATA__
 
+#include <sched.h>
+
 #include "mytypes.h"
 
 typedef struct st_ShellData
 {
     String home_dir_path, prev_command, prev_path;
+    String prompt, prompt_ident, cwd;
     struct termios* shell_tmodes;
     fd_t shell_terminal;
     pid_t shell_pgid;
     JobList jobs;
+    LineReader reader;
+    History history;
+    CmdHash cmds;
+    bool_t interactive;
+    // Default CPU set for background jobs that were not pinned explicitly.
+    bool_t bg_pinned;
+    cpu_set_t bg_cpus;
+    // Background jobs run SCHED_BATCH with idle I/O and bg_nice (0 unless
+    // set with prio -n) added to their nice value, unless bg_demote is off
+    // or the job opted out.
+    bool_t bg_demote;
+    int bg_nice;
 } st_ShellData;
 
 typedef st_ShellData* ShellData;
@@ -18,6 +33,6 @@ ShellData shelldata_create();
 
 void shelldata_delete(ShellData sd);
 
-ShellData init_shell();
+ShellData init_shell(LineReader reader, bool_t interactive);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef __TOKENIZER__
+#define __TOKENIZER__
+
+#include "mytypes.h"
+
+typedef enum {
+    TOK_END,
+    TOK_WORD,
+    TOK_PIPE,
+    TOK_SEMI,
+    TOK_AMP,
+    TOK_IN,
+    TOK_OUT,
+    TOK_APPEND
+} tokentype_t;
+
+typedef struct st_Token
+{
+    tokentype_t type;
+    size_t off, len;
+} st_Token;
+
+typedef st_Token* Token;
+
+typedef struct st_Tokenizer
+{
+    char* buf;
+    size_t len, pos, prev_end;
+    st_Token curr;
+} st_Tokenizer;
+
+typedef st_Tokenizer* Tokenizer;
+
+size_t scan_whitespace(const char* buf, size_t pos, size_t stop);
+size_t scan_word(const char* buf, size_t pos, size_t stop);
+
+void tokenizer_init(Tokenizer tz, char* buf, size_t len);
+Token tokenizer_peek(Tokenizer tz);
+void tokenizer_next(Tokenizer tz);
+
+#endif
\ No newline at end of file
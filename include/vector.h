@@ -13,6 +13,7 @@ typedef struct st_Vector
 typedef st_Vector* Vector;
 
 Vector vector_create(size_t buflen);
+Vector vector_create_arena(Arena a, Vector src);
 
 void vector_append(Vector v, void* data);
 
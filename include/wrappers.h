@@ -5,6 +5,5 @@
 
 errcode_t wrap_getname(char* buf, size_t buflen);
 errcode_t wrap_getcwd(char* buf, size_t buflen);
-errcode_t wrap_fgets(char* buf, size_t buflen);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+Region allocator for objects sharing one lifetime (a parsed command line).
+The arena header and its first block come from a single malloc, and nothing
+carved out of it is freed individually. Owners take a reference with
+arena_retain and the whole region goes away on the last arena_release.
+*/
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static size_t arena_align(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+Arena arena_create(size_t blocksize) {
+    if (blocksize == 0)
+        blocksize = ARENA_BLOCK_SIZE;
+    blocksize = arena_align(blocksize);
+
+    size_t hdrsize = arena_align(sizeof(st_Arena));
+    char* mem = malloc(hdrsize + sizeof(st_ArenaBlock) + blocksize);
+    Arena a = (Arena)mem;
+    a->head = (ArenaBlock)(mem + hdrsize);
+    a->head->next = NULL;
+    a->head->size = blocksize;
+    a->head->used = 0;
+    a->refs = 1;
+    return a;
+}
+
+void* arena_alloc(Arena a, size_t size) {
+    size = arena_align(size);
+    ArenaBlock blk = a->head;
+    if (blk->size - blk->used < size)
+    {
+        size_t newsize = blk->size * 2;
+        if (newsize < size)
+            newsize = size;
+        blk = malloc(sizeof(st_ArenaBlock) + newsize);
+        blk->next = a->head;
+        blk->size = newsize;
+        blk->used = 0;
+        a->head = blk;
+    }
+    void* ret = blk->data + blk->used;
+    blk->used += size;
+    return ret;
+}
+
+char* arena_strndup(Arena a, const char* s, size_t n) {
+    char* ret = arena_alloc(a, n+1);
+    memcpy(ret, s, n);
+    ret[n] = 0;
+    return ret;
+}
+
+Arena arena_retain(Arena a) {
+    a->refs++;
+    return a;
+}
+
+void arena_release(Arena a) {
+    if (!a || --a->refs > 0)
+        return;
+    ArenaBlock blk = a->head;
+    // The last block in the chain lives inside the arena's own allocation.
+    while (blk->next)
+    {
+        ArenaBlock next = blk->next;
+        free(blk);
+        blk = next;
+    }
+    free(a);
+}
\ No newline at end of file
@@ -0,0 +1,208 @@
+#define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "shelldata.h"
+#include "jobctrl.h"
+#include "jobhandler.h"
+#include "parser.h"
+#include "mystring.h"
+#include "vector.h"
+#include "cmdhash.h"
+#include "utils.h"
+
+/*
+bench runs inside the shell, so every run goes through parse_input and
+run_job just like a typed line: the same lookup, spawn, terminal handoff and
+reaping, minus the history. A run that is stopped or killed by SIGINT ends
+the benchmark. A stopped run stays in the job list for fg.
+*/
+
+typedef struct st_BenchStats
+{
+    double mean, stddev, user, sys;
+    int64_t min, p50, p95, p99, max;
+} st_BenchStats;
+
+typedef st_BenchStats* BenchStats;
+
+static bool_t job_interrupted(Job j) {
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->is_done && procs[i]->status >= 0 && WIFSIGNALED(procs[i]->status) && WTERMSIG(procs[i]->status) == SIGINT)
+            return true;
+    return false;
+}
+
+// Runs cmd once into run. Returns false when the benchmark has to stop.
+static bool_t bench_run_once(ShellData sd, String cmd, BenchRun run) {
+    JobList jl = parse_input(sd, cmd);
+    if (!jl)
+        return false;
+
+    bool_t ok = true;
+    size_t i = 0;
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (; i < jl->nslots && ok; i++)
+    {
+        Job j = jl->slots[i];
+        cmdhash_expire(sd->cmds);
+        run_job(sd, j);
+        run->user += j->usage.user;
+        run->sys += j->usage.sys;
+        ok = job_is_done(j) || !job_is_stopped(j);
+        ok = ok && !job_interrupted(j);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    run->real_ns = timespec_diff_ns(&start, &stop);
+
+    // Jobs that ran are handed to the shell like any others, which reaps and
+    // drops them. Those an interruption skipped are simply discarded.
+    for (size_t k = 0; k < jl->nslots; k++)
+        if (jl->slots[k] && k < i)
+            joblist_add_job(sd->jobs, jl->slots[k]);
+        else if (jl->slots[k])
+            job_delete(jl->slots[k]);
+    joblist_delete(jl, false);
+    joblist_update(sd->jobs);
+    return ok;
+}
+
+bool_t bench_run(ShellData sd, Bench b) {
+    for (size_t i = 0; i < b->warmups + b->runs; i++)
+        for (size_t c = 0; c < b->ncmds; c++)
+        {
+            st_BenchRun run = {0, 0, 0};
+            if (!bench_run_once(sd, b->cmds[c], &run))
+            {
+                fprintf(stderr, "bench: Stopped during run %ld of %s.\n", i + 1, string_get_cstr(b->cmds[c]));
+                return false;
+            }
+            if (i >= b->warmups)
+                b->results[c][i - b->warmups] = run;
+        }
+    return true;
+}
+
+static int int64_cmp(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of n sorted values.
+static int64_t percentile(int64_t* sorted, size_t n, size_t pct) {
+    size_t rank = (pct * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void bench_stats(BenchRun runs, size_t n, BenchStats st) {
+    int64_t* sorted = malloc(sizeof(int64_t) * n);
+    double sum = 0, user = 0, sys = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sorted[i] = runs[i].real_ns;
+        sum += runs[i].real_ns;
+        user += runs[i].user;
+        sys += runs[i].sys;
+    }
+    qsort(sorted, n, sizeof(int64_t), int64_cmp);
+
+    st->mean = sum / n;
+    double sqdev = 0;
+    for (size_t i = 0; i < n; i++)
+        sqdev += (sorted[i] - st->mean) * (sorted[i] - st->mean);
+    st->stddev = n > 1 ? sqrt(sqdev / (n - 1)) : 0;
+    // CPU times are kept in nanoseconds too, so one formatter serves all.
+    st->user = user * 1000 / n;
+    st->sys = sys * 1000 / n;
+    st->min = sorted[0];
+    st->p50 = percentile(sorted, n, 50);
+    st->p95 = percentile(sorted, n, 95);
+    st->p99 = percentile(sorted, n, 99);
+    st->max = sorted[n - 1];
+    free(sorted);
+}
+
+static void print_duration(const char* label, double ns) {
+    if (ns < 1e3)
+        printf("%s %.0fns", label, ns);
+    else if (ns < 1e6)
+        printf("%s %.2fus", label, ns / 1e3);
+    else if (ns < 1e9)
+        printf("%s %.2fms", label, ns / 1e6);
+    else
+        printf("%s %.3fs", label, ns / 1e9);
+}
+
+// Two-sided 95% critical value of Student's t with df degrees of freedom.
+static double t_critical(double df) {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < 1)
+        df = 1;
+    if (df <= 30)
+        return table[(size_t)df - 1];
+    if (df <= 60)
+        return 2.021;
+    if (df <= 120)
+        return 2.000;
+    return 1.960;
+}
+
+/*
+Speedup of the second command over the first is the ratio of their mean wall
+times. Its standard error follows from the delta method. The interval uses
+Student's t with Welch's degrees of freedom, because the two commands need
+not have the same variance.
+*/
+static void bench_compare(Bench b, BenchStats a, BenchStats c) {
+    double n = b->runs;
+    double ratio = a->mean / c->mean;
+    printf("speedup of %s over %s: %.3fx", string_get_cstr(b->cmds[1]), string_get_cstr(b->cmds[0]), ratio);
+    if (b->runs < 2)
+    {
+        printf("\n");
+        return;
+    }
+    double va = a->stddev * a->stddev / n;
+    double vc = c->stddev * c->stddev / n;
+    double se = ratio * sqrt(va / (a->mean * a->mean) + vc / (c->mean * c->mean));
+    double df = (va + vc > 0) ? (va + vc) * (va + vc) / (va * va / (n - 1) + vc * vc / (n - 1)) : INFINITY;
+    double t = t_critical(df);
+    printf(" (95%% CI %.3fx to %.3fx)\n", ratio - t * se, ratio + t * se);
+}
+
+void bench_report(Bench b) {
+    st_BenchStats stats[2];
+    for (size_t c = 0; c < b->ncmds; c++)
+    {
+        BenchStats st = &stats[c];
+        bench_stats(b->results[c], b->runs, st);
+        printf("bench: %s (%ld runs, %ld warmup)\n", string_get_cstr(b->cmds[c]), b->runs, b->warmups);
+        print_duration("  mean", st->mean);
+        print_duration(" ±", st->stddev);
+        printf("\n");
+        print_duration("  min", st->min);
+        print_duration("  p50", st->p50);
+        print_duration("  p95", st->p95);
+        print_duration("  p99", st->p99);
+        print_duration("  max", st->max);
+        printf("\n");
+        print_duration("  user", st->user);
+        print_duration("  sys", st->sys);
+        printf(" per run\n");
+    }
+    if (b->ncmds == 2)
+        bench_compare(b, &stats[0], &stats[1]);
+}
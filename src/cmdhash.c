@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cmdhash.h"
+#include "utils.h"
+
+#define PATH_MAX 4096
+
+/*
+Maps command names to the executable PATH resolves them to, so launching a
+command doesn't cost one failed execve per PATH directory in front of it.
+Names that resolve nowhere are cached too, so a repeated typo is reported
+without touching the filesystem.
+
+The table is only trusted for the PATH value it was built under and while
+no PATH directory's mtime has moved; adding or removing a file changes the
+mtime of its directory. Comparing PATH is a strcmp on every lookup. The
+mtimes cost one stat per directory, so they are only swept when a name is
+not in the table yet, or when the last sweep is older than
+CMDHASH_RECHECK_MS, and at most once per job (see cmdhash_expire). A
+cached hit, found or not, therefore costs no system calls at all. A command
+installed while the shell runs is picked up the first time its name is
+used, or by the next sweep if the name was already cached as missing. A
+file removed from under a cached path is caught when the spawn fails and
+the name is resolved again. Any change empties the table. With a relative
+directory in PATH the answer depends on the cwd, so nothing is cached.
+*/
+
+CmdHash cmdhash_create() {
+    CmdHash h = malloc(sizeof(st_CmdHash));
+    h->entries = NULL;
+    h->cap = h->used = 0;
+    h->path = NULL;
+    h->dirs = NULL;
+    h->mtimes = NULL;
+    h->ndirs = 0;
+    h->checked_at.tv_sec = h->checked_at.tv_nsec = 0;
+    h->checked = false;
+    h->relative = false;
+    return h;
+}
+
+static void cmdhash_free_dirs(CmdHash h) {
+    for (size_t i = 0; i < h->ndirs; i++)
+        free(h->dirs[i]);
+    free(h->dirs);
+    free(h->mtimes);
+    free(h->path);
+    h->dirs = NULL;
+    h->mtimes = NULL;
+    h->path = NULL;
+    h->ndirs = 0;
+}
+
+void cmdhash_clear(CmdHash h) {
+    for (size_t i = 0; i < h->cap; i++)
+        if (h->entries[i].name)
+        {
+            free(h->entries[i].name);
+            free(h->entries[i].path);
+            h->entries[i].name = NULL;
+        }
+    h->used = 0;
+}
+
+void cmdhash_delete(CmdHash h) {
+    if (!h)
+        return;
+    cmdhash_clear(h);
+    free(h->entries);
+    cmdhash_free_dirs(h);
+    free(h);
+}
+
+// Makes the next lookup recheck PATH and its directories.
+void cmdhash_expire(CmdHash h) {
+    h->checked = false;
+}
+
+static void cmdhash_stat_dir(const char* dir, struct timespec* mtime) {
+    struct stat st;
+    if (stat(dir, &st) < 0)
+        mtime->tv_sec = mtime->tv_nsec = -1;
+    else
+        *mtime = st.st_mtim;
+}
+
+static void cmdhash_split_path(CmdHash h, const char* path) {
+    cmdhash_free_dirs(h);
+    h->path = strdup(path);
+    h->relative = false;
+
+    size_t n = 1;
+    for (const char* c = path; *c; c++)
+        if (*c == ':')
+            n++;
+    h->dirs = malloc(sizeof(char*) * n);
+    h->mtimes = malloc(sizeof(struct timespec) * n);
+
+    const char* start = path;
+    while (true)
+    {
+        const char* end = strchrnul(start, ':');
+        // An empty element means the current directory.
+        char* dir = (end == start) ? strdup(".") : strndup(start, end - start);
+        if (dir[0] != '/')
+            h->relative = true;
+        cmdhash_stat_dir(dir, &h->mtimes[h->ndirs]);
+        h->dirs[h->ndirs++] = dir;
+        if (!*end)
+            break;
+        start = end + 1;
+    }
+}
+
+// Rebuilds the directory list if PATH is not what the table was built for.
+static void cmdhash_check_path(CmdHash h) {
+    const char* path = getenv("PATH");
+    if (!path)
+        path = CMDHASH_DEFAULT_PATH;
+    if (h->path && strcmp(h->path, path) == 0)
+        return;
+    cmdhash_clear(h);
+    cmdhash_split_path(h, path);
+    h->checked = true;
+    clock_gettime(CLOCK_MONOTONIC, &h->checked_at);
+}
+
+static bool_t cmdhash_is_stale(CmdHash h) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (now.tv_sec - h->checked_at.tv_sec) * 1000 + (now.tv_nsec - h->checked_at.tv_nsec) / 1000000;
+    return ms >= CMDHASH_RECHECK_MS;
+}
+
+// Empties the table if any PATH directory changed since the last sweep.
+static void cmdhash_check_dirs(CmdHash h) {
+    if (h->checked)
+        return;
+    h->checked = true;
+    clock_gettime(CLOCK_MONOTONIC, &h->checked_at);
+
+    bool_t changed = false;
+    for (size_t i = 0; i < h->ndirs; i++)
+    {
+        struct timespec mtime;
+        cmdhash_stat_dir(h->dirs[i], &mtime);
+        if (mtime.tv_sec != h->mtimes[i].tv_sec || mtime.tv_nsec != h->mtimes[i].tv_nsec)
+        {
+            h->mtimes[i] = mtime;
+            changed = true;
+        }
+    }
+    if (changed)
+        cmdhash_clear(h);
+}
+
+// Returns a malloc'd path to the first executable regular file called name
+// in PATH, or NULL. The cheap stat rules out most directories before the
+// access check.
+static char* cmdhash_resolve(CmdHash h, const char* name) {
+    char buf[PATH_MAX];
+    for (size_t i = 0; i < h->ndirs; i++)
+    {
+        int len = snprintf(buf, sizeof(buf), "%s/%s", h->dirs[i], name);
+        if (len < 0 || len >= sizeof(buf))
+            continue;
+        struct stat st;
+        if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0)
+            return strdup(buf);
+    }
+    return NULL;
+}
+
+static size_t cmdhash_home(const char* name, size_t cap) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = name; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    return hash & (cap - 1);
+}
+
+static CmdHashEntry cmdhash_slot(CmdHash h, const char* name) {
+    size_t i = cmdhash_home(name, h->cap);
+    while (h->entries[i].name && strcmp(h->entries[i].name, name) != 0)
+        i = (i + 1) & (h->cap - 1);
+    return &h->entries[i];
+}
+
+static void cmdhash_grow(CmdHash h) {
+    CmdHashEntry old = h->entries;
+    size_t oldcap = h->cap;
+    h->cap = oldcap ? oldcap * 2 : CMDHASH_MIN_CAP;
+    h->entries = calloc(h->cap, sizeof(st_CmdHashEntry));
+    for (size_t i = 0; i < oldcap; i++)
+        if (old[i].name)
+            *cmdhash_slot(h, old[i].name) = old[i];
+    free(old);
+}
+
+// Finds the entry for name, resolving and adding it if it is new.
+static CmdHashEntry cmdhash_get(CmdHash h, const char* name) {
+    if ((h->used + 1) * 4 > h->cap * 3)
+        cmdhash_grow(h);
+    CmdHashEntry e = cmdhash_slot(h, name);
+    if (!e->name)
+    {
+        e->name = strdup(name);
+        e->path = cmdhash_resolve(h, name);
+        e->hits = 0;
+        h->used++;
+    }
+    return e;
+}
+
+static CmdHashEntry cmdhash_find(CmdHash h, const char* name) {
+    if (h->used == 0)
+        return NULL;
+    CmdHashEntry e = cmdhash_slot(h, name);
+    return e->name ? e : NULL;
+}
+
+/*
+Returns the path to execute for name, or NULL if PATH has no such command.
+Names containing a slash are returned as they are. The result stays valid
+until the table is next cleared, or until the next lookup when PATH holds
+a relative directory.
+*/
+const char* cmdhash_lookup(CmdHash h, const char* name) {
+    if (strchr(name, '/'))
+        return name;
+    cmdhash_check_path(h);
+    if (h->relative)
+    {
+        static char* uncached = NULL;
+        free(uncached);
+        uncached = cmdhash_resolve(h, name);
+        return uncached;
+    }
+    CmdHashEntry e = cmdhash_find(h, name);
+    if (!e || cmdhash_is_stale(h))
+    {
+        cmdhash_check_dirs(h);
+        e = cmdhash_get(h, name);
+    }
+    e->hits++;
+    return e->path;
+}
+
+// Resolves name again, for when its cached path turned out to be stale.
+const char* cmdhash_rehash(CmdHash h, const char* name) {
+    if (strchr(name, '/'))
+        return name;
+    cmdhash_check_path(h);
+    if (h->relative)
+        return cmdhash_lookup(h, name);
+    cmdhash_check_dirs(h);
+    CmdHashEntry e = cmdhash_get(h, name);
+    free(e->path);
+    e->path = cmdhash_resolve(h, name);
+    return e->path;
+}
+
+void cmdhash_print(CmdHash h) {
+    if (h->used == 0)
+    {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < h->cap; i++)
+    {
+        CmdHashEntry e = &h->entries[i];
+        if (!e->name)
+            continue;
+        if (e->path)
+            printf("%4ld\t%s\n", e->hits, e->path);
+        else
+            printf("%4ld\t%s (not found)\n", e->hits, e->name);
+    }
+}
@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+#include "history.h"
+#include "mystring.h"
+#include "utils.h"
+
+/*
+Command history is an append-only log of variable-length binary records in
+~/.yash_history, plus a trigram index in ~/.yash_history.idx. Every running
+shell maps both files and shares them. Besides the command, a record carries
+when it started, how long it took in wall and CPU time, its exit status and
+the directory it ran in. Every command is stored, even a repeat, so timings
+are never lost; log collapses consecutive repeats when it reads them back.
+
+Records are added with a single write() on an O_APPEND descriptor. The kernel
+serialises appends to one file, so concurrent shells never overwrite each
+other. Appenders only share a flock on the data file, which keeps them out of
+the way of a repair. The file size is the end of the newest record, and every
+record ends with a copy of its size. So log walks backwards from the current
+size and sees other sessions' commands without rescanning anything. Purging
+only moves the header's start mark forward: the file never shrinks under
+another shell's mapping.
+
+A crash or a full disk can still leave a record cut short at the end of the
+file. The first shell to open the log checks that the last record's trailer
+and header agree. If they do not, it walks the records from the start and
+truncates the file at the end of the last whole one, so nothing is appended
+after a torn record. The repair runs under an exclusive flock and is the only
+time the file shrinks.
+
+The trigram index hashes every 3-byte substring of a command into one of
+HISTORY_BUCKETS buckets. Each bucket holds a list of record offsets, stored
+in fixed-size chunks linked newest first. The index records how far into the
+data file it has got (indexed), and whichever shell touches it next catches
+it up under a short flock on the index file. A search picks the query
+trigram with the shortest list and verifies each candidate, then linearly
+scans any tail that has not been indexed yet.
+*/
+
+#define HISTORY_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+static errcode_t mapfile_map(MappedFile mf, size_t size) {
+    void* base;
+    if (mf->base)
+        base = mremap(mf->base, mf->size, size, MREMAP_MAYMOVE);
+    else
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mf->fd, 0);
+    if (base == MAP_FAILED)
+        return -1;
+    mf->base = base;
+    mf->size = size;
+    return 0;
+}
+
+static errcode_t mapfile_open(MappedFile mf, const char* path) {
+    mf->base = NULL;
+    mf->size = 0;
+    mf->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    return (mf->fd < 0) ? -1 : 0;
+}
+
+static void mapfile_close(MappedFile mf) {
+    if (mf->base)
+        munmap(mf->base, mf->size);
+    close(mf->fd);
+}
+
+static size_t mapfile_file_size(MappedFile mf) {
+    struct stat info;
+    if (fstat(mf->fd, &info) < 0)
+        return 0;
+    return info.st_size;
+}
+
+// Maps at least size bytes, leaving room past the end of the file (which
+// mmap allows) so that growth does not force a remap every time.
+static errcode_t mapfile_cover(MappedFile mf, size_t size) {
+    if (size <= mf->size)
+        return 0;
+    return mapfile_map(mf, (size*2 > HISTORY_MIN_SIZE) ? size*2 : HISTORY_MIN_SIZE);
+}
+
+static HistoryHeader history_hdr(History h) {
+    return (HistoryHeader)h->data.base;
+}
+
+static HistoryRecord history_rec(History h, uint64_t off) {
+    return (HistoryRecord)(h->data.base + off);
+}
+
+static HistoryIndexHeader history_idxhdr(History h) {
+    return (HistoryIndexHeader)h->index.base;
+}
+
+static HistoryBucket history_buckets(History h) {
+    return (HistoryBucket)(h->index.base + HISTORY_DATA_START);
+}
+
+static HistoryChunk history_chunk(History h, uint64_t off) {
+    return (HistoryChunk)(h->index.base + off);
+}
+
+// len covers both the command and the cwd.
+static size_t history_record_size(size_t len) {
+    return HISTORY_ALIGN(sizeof(st_HistoryRecord) + len) + sizeof(uint64_t);
+}
+
+static uint32_t history_trigram(const char* s) {
+    uint32_t t = ((uint32_t)(unsigned char)s[0] << 16) | ((uint32_t)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+    return (t * 2654435761u) >> 16 & (HISTORY_BUCKETS - 1);
+}
+
+// Offset of the oldest record that has not been purged.
+uint64_t history_begin(History h) {
+    return __atomic_load_n(&history_hdr(h)->start, __ATOMIC_ACQUIRE);
+}
+
+// Called with the index locked exclusively.
+static void history_reset_index(History h, uint64_t start) {
+    HistoryIndexHeader ihdr = history_idxhdr(h);
+    ihdr->magic = 0;
+    ihdr->version = HISTORY_VERSION;
+    memset(history_buckets(h), 0, sizeof(st_HistoryBucket) * HISTORY_BUCKETS);
+    ihdr->end = HISTORY_INDEX_START;
+    ihdr->indexed = start;
+    __atomic_store_n(&ihdr->magic, HISTORY_INDEX_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Whether a whole, self-consistent record starts at off in a file of fsize
+// bytes.
+static bool_t history_valid_record(History h, uint64_t off, uint64_t fsize) {
+    if (off < HISTORY_DATA_START || off + sizeof(st_HistoryRecord) + sizeof(uint64_t) > fsize)
+        return false;
+    HistoryRecord rec = history_rec(h, off);
+    uint64_t size = rec->size;
+    return (size % 8 == 0 && off + size <= fsize &&
+            history_record_size((uint64_t)rec->len + rec->cwdlen) == size &&
+            *(uint64_t*)(h->data.base + off + size - sizeof(uint64_t)) == size);
+}
+
+// Cuts off a record torn by a crash or a short write. Called with the data
+// file locked exclusively, so no append is in flight.
+static errcode_t history_repair(History h) {
+    uint64_t fsize = mapfile_file_size(&h->data);
+    uint64_t start = history_begin(h);
+    if (fsize == start)
+        return 0;
+    if (fsize >= start + sizeof(uint64_t))
+    {
+        uint64_t size = *(uint64_t*)(h->data.base + fsize - sizeof(uint64_t));
+        if (size <= fsize - start && history_valid_record(h, fsize - size, fsize) && history_rec(h, fsize - size)->size == size)
+            return 0;
+    }
+
+    uint64_t end = start;
+    while (history_valid_record(h, end, fsize))
+        end += history_rec(h, end)->size;
+    fprintf(stderr, "history: Dropped %lu bytes of a torn record\n", (unsigned long)(fsize - end));
+    return ftruncate(h->data.fd, end);
+}
+
+// Called with the data file locked, so only the first shell writes the header.
+static errcode_t history_init_data(History h) {
+    size_t size = mapfile_file_size(&h->data);
+    if (size >= HISTORY_DATA_START)
+    {
+        st_HistoryHeader cur;
+        if (pread(h->data.fd, &cur, sizeof(cur), 0) == sizeof(cur) &&
+            cur.magic == HISTORY_MAGIC && cur.version == HISTORY_VERSION &&
+            cur.start >= HISTORY_DATA_START && cur.start <= size)
+            return 0;
+    }
+
+    char hdrbuf[HISTORY_DATA_START] = {0};
+    st_HistoryHeader hdr = {HISTORY_MAGIC, HISTORY_VERSION, HISTORY_DATA_START, 0};
+    memcpy(hdrbuf, &hdr, sizeof(hdr));
+    if (ftruncate(h->data.fd, 0) < 0 || pwrite(h->data.fd, hdrbuf, sizeof(hdrbuf), 0) != sizeof(hdrbuf))
+        return -1;
+    return 0;
+}
+
+// Keeps the index mapping in step with growth done by other shells. Called
+// with the index locked.
+static errcode_t history_sync_index(History h) {
+    size_t size = mapfile_file_size(&h->index);
+    if (size > h->index.size)
+        return mapfile_map(&h->index, size);
+    return 0;
+}
+
+// Grows the index file (at least doubling it) so that it holds size bytes.
+// Called with the index locked exclusively.
+static errcode_t history_reserve_index(History h, size_t size) {
+    if (size <= h->index.size)
+        return 0;
+    size_t newsize = h->index.size * 2;
+    if (newsize < size)
+        newsize = size;
+    if (ftruncate(h->index.fd, newsize) < 0)
+        return -1;
+    return mapfile_map(&h->index, newsize);
+}
+
+static errcode_t history_init_index(History h) {
+    if (flock(h->index.fd, LOCK_EX) < 0)
+        return -1;
+    errcode_t ret = 0;
+    size_t minsize = HISTORY_INDEX_START + HISTORY_MIN_SIZE;
+    size_t size = mapfile_file_size(&h->index);
+    if (size < minsize && ftruncate(h->index.fd, minsize) < 0)
+        ret = -1;
+    else if (mapfile_map(&h->index, (size > minsize) ? size : minsize) < 0)
+        ret = -1;
+    else
+    {
+        // The index is only a cache of the data file and is rebuilt freely.
+        HistoryIndexHeader ihdr = history_idxhdr(h);
+        uint64_t start = history_begin(h);
+        if (ihdr->magic != HISTORY_INDEX_MAGIC || ihdr->version != HISTORY_VERSION ||
+            ihdr->indexed < start || ihdr->indexed > history_end(h) ||
+            ihdr->end < HISTORY_INDEX_START || ihdr->end > h->index.size)
+            history_reset_index(h, start);
+    }
+    flock(h->index.fd, LOCK_UN);
+    return ret;
+}
+
+History history_open(const char* path) {
+    History h = malloc(sizeof(st_History));
+    errcode_t ret = mapfile_open(&h->data, path);
+    if (ret == 0)
+    {
+        if (flock(h->data.fd, LOCK_EX) < 0 || history_init_data(h) < 0 ||
+            mapfile_cover(&h->data, mapfile_file_size(&h->data)) < 0 || history_repair(h) < 0)
+            ret = -1;
+        flock(h->data.fd, LOCK_UN);
+    }
+    if (ret == 0 && fcntl(h->data.fd, F_SETFL, O_APPEND) < 0)
+        ret = -1;
+    if (ret < 0)
+    {
+        warn_failure(-1, "history: %s", path);
+        if (h->data.fd >= 0)
+            mapfile_close(&h->data);
+        free(h);
+        return NULL;
+    }
+
+    st_StringBuilder sb;
+    strbuilder_init(&sb, strlen(path) + 5);
+    strbuilder_append_cstr(&sb, path);
+    strbuilder_append_cstrn(&sb, ".idx", 4);
+    String idxpath = strbuilder_finish(&sb);
+    ret = mapfile_open(&h->index, string_get_cstr(idxpath));
+    if (ret == 0)
+        ret = history_init_index(h);
+    if (ret < 0)
+    {
+        warn_failure(-1, "history: %s", string_get_cstr(idxpath));
+        if (h->index.fd >= 0)
+            mapfile_close(&h->index);
+        mapfile_close(&h->data);
+        string_delete(idxpath);
+        free(h);
+        return NULL;
+    }
+    string_delete(idxpath);
+
+    history_index_update(h);
+    return h;
+}
+
+void history_close(History h) {
+    if (!h)
+        return;
+    mapfile_close(&h->data);
+    mapfile_close(&h->index);
+    free(h);
+}
+
+size_t history_count(History h) {
+    if (!h)
+        return 0;
+    return __atomic_load_n(&history_hdr(h)->count, __ATOMIC_RELAXED);
+}
+
+// Current end of the log, including records appended by other shells.
+uint64_t history_end(History h) {
+    uint64_t end = mapfile_file_size(&h->data);
+    if (mapfile_cover(&h->data, end) < 0)
+        return history_begin(h);
+    return end;
+}
+
+// Offset of the record that ends at end, or 0 if there is none.
+uint64_t history_prev(History h, uint64_t end) {
+    uint64_t start = history_begin(h);
+    if (end <= start)
+        return 0;
+    uint64_t size = *(uint64_t*)(h->data.base + end - sizeof(uint64_t));
+    if (size == 0 || size > end - start || history_rec(h, end - size)->size != size)
+        return 0;
+    return end - size;
+}
+
+HistoryRecord history_record(History h, uint64_t off) {
+    return history_rec(h, off);
+}
+
+// The text is not NUL-terminated and points into the mapping, which moves
+// whenever the file grows.
+char* history_text(History h, uint64_t off, size_t* len) {
+    HistoryRecord rec = history_rec(h, off);
+    *len = rec->len;
+    return rec->text;
+}
+
+char* history_cwd(History h, uint64_t off, size_t* len) {
+    HistoryRecord rec = history_rec(h, off);
+    *len = rec->cwdlen;
+    return rec->text + rec->len;
+}
+
+static bool_t history_same_text(History h, uint64_t a, uint64_t b) {
+    HistoryRecord ra = history_rec(h, a), rb = history_rec(h, b);
+    return (ra->len == rb->len && memcmp(ra->text, rb->text, ra->len) == 0);
+}
+
+// The next record before off whose command differs from the one at off.
+uint64_t history_older(History h, uint64_t off) {
+    uint64_t prev = history_prev(h, off);
+    while (prev != 0 && history_same_text(h, prev, off))
+        prev = history_prev(h, prev);
+    return prev;
+}
+
+// Entry idx counted from the most recent one (idx 1), repeats collapsed.
+char* history_get(History h, size_t idx, size_t* len) {
+    if (!h || idx < 1)
+        return NULL;
+    uint64_t off = history_prev(h, history_end(h));
+    for (size_t i = 1; i < idx && off != 0; i++)
+        off = history_older(h, off);
+    if (off == 0)
+        return NULL;
+    return history_text(h, off, len);
+}
+
+// Appends cmd with the timing and status in meta; meta's size and length
+// fields are filled in here.
+void history_append(History h, HistoryRecord meta, const char* cmd, size_t len, const char* cwd, size_t cwdlen) {
+    if (!h || len == 0)
+        return;
+
+    uint64_t size = history_record_size(len + cwdlen);
+    st_HistoryRecord rec = *meta;
+    rec.size = size;
+    rec.len = len;
+    rec.cwdlen = cwdlen;
+    char pad[8] = {0};
+    struct iovec iov[5] = {
+        {&rec, sizeof(rec)},
+        {(char*)cmd, len},
+        {(char*)cwd, cwdlen},
+        {pad, size - sizeof(rec) - len - cwdlen - sizeof(size)},
+        {&size, sizeof(size)},
+    };
+
+    // One write on an O_APPEND descriptor is the whole reservation protocol.
+    // The shared lock only keeps a repair from truncating under it.
+    if (flock(h->data.fd, LOCK_SH) < 0)
+        return;
+    ssize_t written = writev(h->data.fd, iov, 5);
+    flock(h->data.fd, LOCK_UN);
+    if (written != (ssize_t)size)
+    {
+        warn_failure(-1, "%s", "history: write");
+        return;
+    }
+    __atomic_fetch_add(&history_hdr(h)->count, 1, __ATOMIC_RELAXED);
+
+    history_index_update(h);
+}
+
+void history_clear(History h) {
+    if (!h || flock(h->index.fd, LOCK_EX) < 0)
+        return;
+    uint64_t end = history_end(h);
+    HistoryHeader hdr = history_hdr(h);
+    __atomic_store_n(&hdr->start, end, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->count, 0, __ATOMIC_RELAXED);
+    if (history_sync_index(h) == 0)
+        history_reset_index(h, end);
+    flock(h->index.fd, LOCK_UN);
+}
+
+static int history_key_cmp(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Called with the index locked exclusively.
+static errcode_t history_index_record(History h, uint64_t off) {
+    size_t len;
+    char* text = history_text(h, off, &len);
+    if (len < 3)
+        return 0;
+
+    size_t nkeys = 0;
+    uint32_t* keys = malloc(sizeof(uint32_t) * (len-2));
+    for (size_t i = 0; i + 2 < len; i++)
+        keys[i] = history_trigram(text + i);
+    qsort(keys, len-2, sizeof(uint32_t), history_key_cmp);
+    for (size_t i = 0; i < len-2; i++)
+        if (nkeys == 0 || keys[nkeys-1] != keys[i])
+            keys[nkeys++] = keys[i];
+
+    // Reserve the worst case up front so no pointer moves while linking.
+    if (history_reserve_index(h, history_idxhdr(h)->end + nkeys*sizeof(st_HistoryChunk)) < 0)
+    {
+        free(keys);
+        return -1;
+    }
+
+    HistoryIndexHeader ihdr = history_idxhdr(h);
+    for (size_t i = 0; i < nkeys; i++)
+    {
+        HistoryBucket bucket = &history_buckets(h)[keys[i]];
+        HistoryChunk chunk = bucket->head ? history_chunk(h, bucket->head) : NULL;
+        if (!chunk || chunk->n == HISTORY_CHUNK_ENTRIES)
+        {
+            chunk = history_chunk(h, ihdr->end);
+            chunk->next = bucket->head;
+            chunk->n = 0;
+            bucket->head = ihdr->end;
+            ihdr->end += sizeof(st_HistoryChunk);
+        }
+        chunk->offs[chunk->n++] = off / 8;
+        bucket->count++;
+    }
+    free(keys);
+    return 0;
+}
+
+void history_index_update(History h) {
+    if (!h || flock(h->index.fd, LOCK_EX) < 0)
+        return;
+    if (history_sync_index(h) < 0)
+    {
+        flock(h->index.fd, LOCK_UN);
+        return;
+    }
+
+    uint64_t end = history_end(h);
+    uint64_t start = history_begin(h);
+    HistoryIndexHeader ihdr = history_idxhdr(h);
+    if (ihdr->indexed < start)
+        history_reset_index(h, start);
+
+    while (ihdr->indexed < end)
+    {
+        uint64_t off = ihdr->indexed;
+        uint64_t size = history_rec(h, off)->size;
+        if (size == 0 || off + size > end || history_index_record(h, off) < 0)
+        {
+            warn_failure(-1, "%s", "history: index");
+            break;
+        }
+        ihdr = history_idxhdr(h);
+        ihdr->indexed = off + size;
+    }
+    flock(h->index.fd, LOCK_UN);
+}
+
+static bool_t history_matches(History h, uint64_t off, const char* query, size_t qlen) {
+    size_t len;
+    char* text = history_text(h, off, &len);
+    return (memmem(text, len, query, qlen) != NULL);
+}
+
+static bool_t history_add_result(History h, uint64_t off, uint64_t* results, size_t* n) {
+    if (*n > 0 && history_same_text(h, results[*n-1], off))
+        return false;
+    results[(*n)++] = off;
+    return true;
+}
+
+// Offsets of up to max records containing query, most recent first. Repeats
+// of the previous match are skipped.
+size_t history_search(History h, const char* query, size_t qlen, uint64_t* results, size_t max) {
+    if (!h || max == 0)
+        return 0;
+    history_index_update(h);
+    if (flock(h->index.fd, LOCK_SH) < 0)
+        return 0;
+    if (history_sync_index(h) < 0)
+    {
+        flock(h->index.fd, LOCK_UN);
+        return 0;
+    }
+
+    size_t n = 0;
+    uint64_t end = history_end(h);
+    uint64_t start = history_begin(h);
+    uint64_t indexed = history_idxhdr(h)->indexed;
+    if (qlen < 3 || indexed < start)
+        indexed = start;
+
+    // Whatever the index has not reached yet is scanned directly.
+    for (uint64_t off = history_prev(h, end); off >= indexed && off != 0 && n < max; off = history_prev(h, off))
+        if (history_matches(h, off, query, qlen))
+            history_add_result(h, off, results, &n);
+
+    HistoryBucket rarest = NULL;
+    for (size_t i = 0; i + 2 < qlen; i++)
+    {
+        HistoryBucket bucket = &history_buckets(h)[history_trigram(query + i)];
+        if (!rarest || bucket->count < rarest->count)
+            rarest = bucket;
+    }
+
+    // Chunks are linked newest first and filled in ascending order, so the
+    // offsets come out descending. Anything out of order is a duplicate left
+    // by an interrupted index update.
+    uint64_t last = indexed;
+    for (uint64_t coff = rarest ? rarest->head : 0; coff != 0 && n < max; coff = history_chunk(h, coff)->next)
+    {
+        HistoryChunk chunk = history_chunk(h, coff);
+        for (uint32_t i = chunk->n; i > 0 && n < max; i--)
+        {
+            uint64_t off = (uint64_t)chunk->offs[i-1] * 8;
+            if (off >= last || off < start)
+                continue;
+            last = off;
+            if (history_matches(h, off, query, qlen))
+                history_add_result(h, off, results, &n);
+        }
+    }
+    flock(h->index.fd, LOCK_UN);
+    return n;
+}
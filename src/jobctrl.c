@@ -1,157 +1,343 @@
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <termios.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <sys/syscall.h>
 
 #include "jobctrl.h"
 #include "utils.h"
 #include "shelldata.h"
 #include "vector.h"
 #include "mystring.h"
+#include "arena.h"
 
 #define PATH_MAX 4096
+#define PIDMAP_MIN_CAP 16
 
-Process process_create(Vector argv) {
-    Process p = malloc(sizeof(st_Process));
-    p->argv = argv;
+// glibc has no ioprio wrappers, so these mirror <linux/ioprio.h>.
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_WHO_PROCESS 1
+enum { IOPRIO_CLASS_NONE, IOPRIO_CLASS_RT, IOPRIO_CLASS_BE, IOPRIO_CLASS_IDLE };
+#define JOBLIST_MIN_SLOTS 8
+
+/*
+Children are reaped from a SIGCHLD self-pipe instead of polling every job.
+The handler only writes a byte; joblist_update drains the pipe and, if
+anything arrived, collects every pending status with waitpid(-1) and routes
+each pid to its process through the job list's pid map. A prompt with no
+child state changes costs a single read, however many jobs are running.
+*/
+
+static fd_t reaper_fds[2] = {-1, -1};
+
+Process process_create(Arena a, char* line, Token args, size_t argc) {
+    Process p = a ? arena_alloc(a, sizeof(st_Process)) : malloc(sizeof(st_Process));
+    p->argv = NULL;
+    p->line = line;
+    p->args = args;
+    p->argc = argc;
     p->is_done = false;
     p->is_stopped = false;
+    p->append = false;
     p->pid = -1;
     p->status = -1;
-    p->in = NULL;
-    p->out = NULL;
-    p->err = NULL;
+    p->in.type = p->out.type = p->err.type = TOK_END;
+    p->in.off = p->out.off = p->err.off = 0;
+    p->in.len = p->out.len = p->err.len = 0;
+    p->arena = a;
+    p->job = NULL;
+    memset(&p->usage, 0, sizeof(st_ResUsage));
+    p->started.tv_sec = p->finished.tv_sec = 0;
+    p->started.tv_nsec = p->finished.tv_nsec = 0;
     return p;
 }
 
-Job job_create(String command, Vector procs) {
-    Job j = malloc(sizeof(st_Job));
+Job job_create(Arena a, String command, Vector procs) {
+    Job j = a ? arena_alloc(a, sizeof(st_Job)) : malloc(sizeof(st_Job));
     j->tmodes = NULL;
     j->command = command;
     j->procs = procs;
     j->pgid = -1;
     j->have_notified = false;
     j->is_bg = false;
+    j->has_changed = false;
+    j->own_pgrp = false;
+    j->arena = a ? arena_retain(a) : NULL;
+    memset(&j->usage, 0, sizeof(st_ResUsage));
+    j->timing = JOB_TIME_NONE;
+    j->is_pinned = false;
+    j->prio = JOB_PRIO_DEFAULT;
+    j->is_demoted = false;
+    j->started.tv_sec = 0;
+    j->started.tv_nsec = 0;
+    j->slot = 0;
+    Process* proclist = (Process*)procs->data;
+    for (int i = 0; i < procs->len; i++)
+        proclist[i]->job = j;
     return j;
 }
 
 JobList joblist_create() {
     JobList jl = malloc(sizeof(st_JobList));
-    jl->sentinel = malloc(sizeof(st_JobListNode));
-    jl->sentinel->job = NULL;
-    jl->sentinel->prev = NULL;
-    jl->sentinel->next = NULL;
-    jl->size = 0;
+    jl->slots = NULL;
+    jl->size = jl->nslots = jl->cap = 0;
+    jl->arena = NULL;
+    jl->line = NULL;
+    jl->pids.keys = jl->pgids.keys = NULL;
+    jl->pids.vals = jl->pgids.vals = NULL;
+    jl->pids.cap = jl->pids.used = 0;
+    jl->pgids.cap = jl->pgids.used = 0;
+    jl->changed = NULL;
     return jl;
 }
 
 void process_delete(Process p) {
-    char** args = (char**)p->argv->data;
-    for (int i = 0; i < p->argv->len; i++)
-        free(args[i]);
-    if (p->in)
-        free(p->in);
-    if (p->out)
-        free(p->out);
-    if (p->err)
-        free(p->err);
-    vector_delete(p->argv);
+    // Arena backed processes are released along with their job.
+    if (p->arena)
+        return;
+    if (p->argv)
+        vector_delete(p->argv);
+    free(p->args);
     free(p);
 }
 
+bool_t process_name_is(Process p, const char* name) {
+    if (p->argc == 0)
+        return false;
+    size_t namelen = strlen(name);
+    return (p->args[0].len == namelen && strncmp(p->line + p->args[0].off, name, namelen) == 0);
+}
+
+// The shell-style exit code of a finished process: its exit status, or 128
+// plus the signal that killed it.
+int process_exit_code(Process p) {
+    if (p->status < 0)
+        return 0;
+    return WIFSIGNALED(p->status) ? 128 + WTERMSIG(p->status) : WEXITSTATUS(p->status);
+}
+
+// NUL-terminates a span of the process's line in place. Only safe once the
+// line has been tokenized, since the terminator overwrites the delimiter.
+char* process_get_cstr(Process p, Token span) {
+    if (span->len == 0)
+        return NULL;
+    p->line[span->off + span->len] = 0;
+    return p->line + span->off;
+}
+
+char** process_get_argv(Process p) {
+    if (p->argv)
+        return (char**)p->argv->data;
+
+    if (p->arena)
+    {
+        p->argv = arena_alloc(p->arena, sizeof(st_Vector));
+        p->argv->data = arena_alloc(p->arena, sizeof(void*)*(p->argc+1));
+    }
+    else
+    {
+        p->argv = malloc(sizeof(st_Vector));
+        p->argv->data = malloc(sizeof(void*)*(p->argc+1));
+    }
+    p->argv->buflen = p->argc+1;
+    p->argv->len = p->argc+1;
+    for (size_t i = 0; i < p->argc; i++)
+        p->argv->data[i] = process_get_cstr(p, &p->args[i]);
+    p->argv->data[p->argc] = NULL;
+    return (char**)p->argv->data;
+}
+
 void job_delete(Job j) {
+    free(j->tmodes);
+    if (j->arena)
+    {
+        arena_release(j->arena);
+        return;
+    }
     Process* procs = (Process*)j->procs->data;
     for (int i = 0; i < j->procs->len; i++)
         process_delete(procs[i]);
     string_delete(j->command);
     vector_delete(j->procs);
-    free(j->tmodes);
     free(j);
 }
 
-void joblistnode_delete(JobListNode node, bool_t deljob) {
-    if (deljob)
-        job_delete(node->job);
-    free(node);
-}
-
 void joblist_delete(JobList jl, bool_t deljobs) {
-    JobListNode node = jl->sentinel->next;
-    if (node)
-        while (node != jl->sentinel)
-        {
-            JobListNode temp = node;
-            node = node->next;
-            joblistnode_delete(temp, deljobs);
-        }
-    free(jl->sentinel);
+    if (deljobs)
+        for (size_t i = 0; i < jl->nslots; i++)
+            if (jl->slots[i])
+                job_delete(jl->slots[i]);
+    arena_release(jl->arena);
+    free(jl->slots);
+    free(jl->pids.keys);
+    free(jl->pids.vals);
+    free(jl->pgids.keys);
+    free(jl->pgids.vals);
+    if (jl->changed)
+        vector_delete(jl->changed);
     free(jl);
 }
 
-void joblist_add_job(JobList jl, Job j) {
-    JobListNode node = malloc(sizeof(st_JobListNode));
-    node->job = j;
-    if (jl->size == 0) {
-        node->next = jl->sentinel;
-        node->prev = jl->sentinel;
-        jl->sentinel->next = node;
-        jl->sentinel->prev = node;
-    } else {
-        jl->sentinel->prev->next = node;
-        node->prev = jl->sentinel->prev;
-        node->next = jl->sentinel;
-        jl->sentinel->prev = node;
+static size_t pidmap_home(pid_t key, size_t cap) {
+    return ((uint32_t)key * 2654435761u) & (cap - 1);
+}
+
+static size_t pidmap_slot(st_PidMap* map, pid_t key) {
+    size_t i = pidmap_home(key, map->cap);
+    while (map->keys[i] && map->keys[i] != key)
+        i = (i + 1) & (map->cap - 1);
+    return i;
+}
+
+static void pidmap_insert(st_PidMap* map, pid_t key, void* val) {
+    if ((map->used + 1) * 4 > map->cap * 3)
+    {
+        st_PidMap old = *map;
+        map->cap = old.cap ? old.cap * 2 : PIDMAP_MIN_CAP;
+        map->keys = calloc(map->cap, sizeof(pid_t));
+        map->vals = malloc(sizeof(void*) * map->cap);
+        for (size_t i = 0; i < old.cap; i++)
+            if (old.keys[i])
+            {
+                size_t slot = pidmap_slot(map, old.keys[i]);
+                map->keys[slot] = old.keys[i];
+                map->vals[slot] = old.vals[i];
+            }
+        free(old.keys);
+        free(old.vals);
     }
-    jl->size++;
+    size_t slot = pidmap_slot(map, key);
+    if (!map->keys[slot])
+        map->used++;
+    map->keys[slot] = key;
+    map->vals[slot] = val;
+}
+
+static void* pidmap_find(st_PidMap* map, pid_t key) {
+    if (map->used == 0)
+        return NULL;
+    size_t slot = pidmap_slot(map, key);
+    return map->keys[slot] ? map->vals[slot] : NULL;
 }
 
-void joblist_pop_node(JobList jl, JobListNode node) {
-    if (jl->size == 0 || !node)
+// Removes key only while it still maps to val, since a recycled pid may
+// already belong to a newer entry. Later entries of the probe cluster are
+// shifted back, so lookups never need tombstones.
+static void pidmap_remove(st_PidMap* map, pid_t key, void* val) {
+    if (map->used == 0)
         return;
-    
-    if (jl->size == 1)
+    size_t mask = map->cap - 1;
+    size_t hole = pidmap_slot(map, key);
+    if (!map->keys[hole] || map->vals[hole] != val)
+        return;
+    for (size_t i = (hole + 1) & mask; map->keys[i]; i = (i + 1) & mask)
     {
-        jl->sentinel->next = NULL;
-        jl->sentinel->prev = NULL;
+        size_t home = pidmap_home(map->keys[i], map->cap);
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            map->keys[hole] = map->keys[i];
+            map->vals[hole] = map->vals[i];
+            hole = i;
+        }
     }
-    else
+    map->keys[hole] = 0;
+    map->used--;
+}
+
+void joblist_add_job(JobList jl, Job j) {
+    if (jl->nslots == jl->cap)
     {
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
+        jl->cap = jl->cap ? jl->cap * 2 : JOBLIST_MIN_SLOTS;
+        jl->slots = realloc(jl->slots, sizeof(Job) * jl->cap);
     }
-    
+    j->slot = jl->nslots;
+    jl->slots[jl->nslots++] = j;
+    jl->size++;
+
+    if (j->pgid > 0)
+        pidmap_insert(&jl->pgids, j->pgid, j);
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0)
+            pidmap_insert(&jl->pids, procs[i]->pid, procs[i]);
+    // Jobs that finished or stopped in the foreground still need reporting
+    // and removal by the next update.
+    if (job_is_done(j) || job_is_stopped(j))
+        joblist_mark_changed(jl, j);
+}
+
+Job joblist_last(JobList jl) {
+    return jl->nslots ? jl->slots[jl->nslots-1] : NULL;
+}
+
+// Closes the holes left by removed jobs, keeping insertion order.
+static void joblist_compact(JobList jl) {
+    size_t n = 0;
+    for (size_t i = 0; i < jl->nslots; i++)
+        if (jl->slots[i])
+        {
+            jl->slots[n] = jl->slots[i];
+            jl->slots[n]->slot = n;
+            n++;
+        }
+    jl->nslots = n;
+}
+
+void joblist_remove_job(JobList jl, Job j) {
+    if (!j || j->slot >= jl->nslots || jl->slots[j->slot] != j)
+        return;
+
+    jl->slots[j->slot] = NULL;
     jl->size--;
+    while (jl->nslots > 0 && !jl->slots[jl->nslots-1])
+        jl->nslots--;
+    if (jl->nslots > JOBLIST_MIN_SLOTS && jl->nslots > 2 * jl->size)
+        joblist_compact(jl);
+
+    if (j->pgid > 0)
+        pidmap_remove(&jl->pgids, j->pgid, j);
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0)
+            pidmap_remove(&jl->pids, procs[i]->pid, procs[i]);
 }
 
-void joblist_delete_node(JobList jl, JobListNode node) {
-    joblist_pop_node(jl, node);
-    joblistnode_delete(node, true);
+void joblist_delete_job(JobList jl, Job j) {
+    joblist_remove_job(jl, j);
+    job_delete(j);
 }
 
 Job joblist_find_job(JobList jl, pid_t pgid) {
-    JobListNode node = jl->sentinel->next;
-    if (!node)
-        return NULL;
-    for (; node != jl->sentinel; node = node->next)
-        if (node->job->pgid == pgid)
-            return node->job;
-    return NULL;
+    return pidmap_find(&jl->pgids, pgid);
+}
+
+Process joblist_find_process(JobList jl, pid_t pid) {
+    return pidmap_find(&jl->pids, pid);
 }
 
+// Only ever asked of a freshly parsed line, which holds a handful of jobs.
 bool_t joblist_check_cmd(JobList jl, char* cmd) {
-    JobListNode node = jl->sentinel->next;
-    if (!node)
-        return false;
-    for (; node != jl->sentinel; node = node->next)
-        for (int i = 0; i < node->job->procs->len; i++)
-            if (strcmp(cmd, ((Process)node->job->procs->data[i])->argv->data[0]) == 0)
+    for (size_t i = 0; i < jl->nslots; i++)
+    {
+        Job j = jl->slots[i];
+        if (!j)
+            continue;
+        for (int k = 0; k < j->procs->len; k++)
+            if (process_name_is(j->procs->data[k], cmd))
                 return true;
+    }
     return false;
 }
 
@@ -176,25 +362,24 @@ void process_print(Process p) {
 
     print_err("pid: %d\n", p->pid);
 
-    print_err("argv (Vector at %p):\n", p->argv);
-    char** argv = (char**)p->argv->data;
-    for (int i = 0; i < p->argv->len; i++)
-        print_err("%s (char* at %p)\n", argv[i], argv[i]);
+    print_err("args (%ld spans into line at %p):\n", p->argc, p->line);
+    for (size_t i = 0; i < p->argc; i++)
+        print_err("%.*s (offset %ld)\n", (int)p->args[i].len, p->line + p->args[i].off, p->args[i].off);
 
     print_err("is_done: %s\n", (p->is_done ? "true" : "false"));
     print_err("is_stopped: %s\n", (p->is_stopped ? "true" : "false"));
     print_err("append: %s\n", (p->append ? "true" : "false"));
     print_err("status: %d\n", p->status);
-    if (p->in)
-        print_err("in: %s\n", p->in);
+    if (p->in.len)
+        print_err("in: %.*s\n", (int)p->in.len, p->line + p->in.off);
     else
         print_err("in: NULL\n");
-    if (p->out)
-        print_err("out: %s\n", p->out);
+    if (p->out.len)
+        print_err("out: %.*s\n", (int)p->out.len, p->line + p->out.off);
     else
         print_err("out: NULL\n");
-    if (p->err)
-        print_err("err: %s\n", p->err);
+    if (p->err.len)
+        print_err("err: %.*s\n", (int)p->err.len, p->line + p->err.off);
     else
         print_err("err: NULL\n");
 }
@@ -219,87 +404,569 @@ void joblist_print(JobList jl) {
     print_err("Debug info for JobList struct at: %p\n", jl);
     if (!jl)
         return;
-    print_err("sentinel (JobListNode struct at %p):\n", jl->sentinel);
-    print_err("prev:%p\n", jl->sentinel->prev);
-    print_err("next:%p\n", jl->sentinel->next);
-    JobListNode node = jl->sentinel->next;
-    if (!node)
+    print_err("size: %ld, slots: %ld of %ld\n", jl->size, jl->nslots, jl->cap);
+    print_err("pids: %ld, pgids: %ld\n", jl->pids.used, jl->pgids.used);
+    for (size_t i = 0; i < jl->nslots; i++)
+    {
+        if (!jl->slots[i])
+            continue;
+        print_err("slot %ld:\n", i);
+        job_print(jl->slots[i]);
+    }
+}
+
+static void reaper_handler(int signum) {
+    int saved_errno = errno;
+    char c = 0;
+    // A full pipe already guarantees a wakeup, so a failed write is fine.
+    ssize_t ret = write(reaper_fds[1], &c, 1);
+    (void)ret;
+    errno = saved_errno;
+}
+
+void jobctrl_init_reaper() {
+    if (pipe(reaper_fds) < 0)
+    {
+        warn_failure(-1, "%s", "pipe");
+        reaper_fds[0] = reaper_fds[1] = -1;
         return;
-    print_err("nodes (JobListNode structs in linked list):\n");
-    for (; node != jl->sentinel; node = node->next)
+    }
+    for (int i = 0; i < 2; i++)
     {
-        print_err("JobListNode struct at %p:\n", node);
-        print_err("prev:%p\n", node->prev);
-        print_err("next:%p\n", node->next);
-        job_print(node->job);
+        fcntl(reaper_fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(reaper_fds[i], F_SETFD, FD_CLOEXEC);
     }
+
+    struct sigaction sact = {0};
+    sact.sa_handler = reaper_handler;
+    sact.sa_flags = SA_RESTART;
+    sigemptyset(&sact.sa_mask);
+    warn_failure(sigaction(SIGCHLD, &sact, NULL), "%s", "sigaction");
 }
 
-errcode_t job_update_status(Job j, pid_t pid, int status) {
-    if (pid == 0 || errno == ECHILD)
-        return -1;
-    else if (pid < 0)
+// Called in forked children, which must not wake the shell's reaper.
+void jobctrl_reset_reaper() {
+    struct sigaction sact = {0};
+    sact.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &sact, NULL);
+    if (reaper_fds[0] >= 0)
     {
-        perror("waitpid");
-        return -1;
+        close(reaper_fds[0]);
+        close(reaper_fds[1]);
+        reaper_fds[0] = reaper_fds[1] = -1;
     }
+}
 
-    Process* procs = (Process*)j->procs->data;
+// Empties the self-pipe and reports whether any SIGCHLD arrived since the
+// last call. Without a reaper every call has to poll.
+static bool_t reaper_drain() {
+    if (reaper_fds[0] < 0)
+        return true;
+    char buf[64];
+    bool_t woken = false;
+    while (read(reaper_fds[0], buf, sizeof(buf)) > 0)
+        woken = true;
+    return woken;
+}
 
+static Process job_find_process(Job j, pid_t pid) {
+    Process* procs = (Process*)j->procs->data;
     for (int i = 0; i < j->procs->len; i++)
         if (procs[i]->pid == pid)
+            return procs[i];
+    return NULL;
+}
+
+static uint64_t timeval_us(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// ru is only meaningful once the process has exited.
+static void process_update_status(Process p, int status, struct rusage* ru) {
+    Job j = p->job;
+    p->status = status;
+    if (!WIFSTOPPED(status))
+    {
+        p->usage.user = timeval_us(ru->ru_utime);
+        p->usage.sys = timeval_us(ru->ru_stime);
+        p->usage.maxrss = ru->ru_maxrss;
+        p->usage.majflt = ru->ru_majflt;
+        p->usage.nvcsw = ru->ru_nvcsw;
+        p->usage.nivcsw = ru->ru_nivcsw;
+        resusage_add(&j->usage, &p->usage);
+        clock_gettime(CLOCK_MONOTONIC, &p->finished);
+    }
+    if (WIFSTOPPED(status))
+    {
+        p->is_stopped = true;
+        if (j->procs->len == 1)
+        {
+            print_err("(%d) %.*s: Stopped\n", p->pid, (int)p->args[0].len, p->line + p->args[0].off);
+            j->have_notified = true;
+        }
+    }
+    else
+    {
+        p->is_done = true;
+        if (j->procs->len == 1 && WIFSIGNALED(status))
+        {
+            print_err("(%d) %.*s: Terminated by signal %d\n", p->pid, (int)p->args[0].len, p->line + p->args[0].off, WTERMSIG(status));
+            j->have_notified = true;
+        }
+    }
+}
+
+// Sends sig to the job's process group, or to each of its live processes
+// when it has none of its own.
+static int job_kill(Job j, int sig) {
+    if (j->own_pgrp)
+        return kill(-j->pgid, sig);
+    int ret = 0;
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0 && !procs[i]->is_done && kill(procs[i]->pid, sig) < 0)
+            ret = -1;
+    return ret;
+}
+
+// Waiting on a process group only works for jobs that have one. The others
+// are waited on one process at a time.
+static pid_t job_wait_target(Job j) {
+    if (j->own_pgrp)
+        return -j->pgid;
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0 && !procs[i]->is_done && !procs[i]->is_stopped)
+            return procs[i]->pid;
+    return -j->pgid;
+}
+
+void job_wait(Job j) {
+    int status;
+    struct rusage ru;
+    while (!job_is_stopped(j) && !job_is_done(j))
+    {
+        pid_t target = job_wait_target(j);
+        pid_t pid = wait4(target, &status, WUNTRACED, &ru);
+        if (pid < 0)
         {
-            procs[i]->status = status;
-            if (WIFSTOPPED(status))
+            if (errno != ECHILD)
             {
-                procs[i]->is_stopped = true;
-                if (j->procs->len == 1)
-                {
-                    print_err("(%d) %s: Stopped\n", pid, (char*)procs[i]->argv->data[0]);
-                    j->have_notified = true;
-                }
+                perror("waitpid");
+                return;
             }
-            else
+            // A single process that has already been reaped elsewhere.
+            Process gone = (target > 0) ? job_find_process(j, target) : NULL;
+            if (gone)
             {
-                procs[i]->is_done = true;
-                if (j->procs->len == 1 && WIFSIGNALED(status))
-                {
-                    print_err("(%d) %s: Terminated by signal %d\n", pid, (char*)procs[i]->argv->data[0], WTERMSIG(status));
-                    j->have_notified = true;
-                }
+                gone->is_done = true;
+                continue;
             }
-            return 0;
+            // Nothing is left in the group, so whatever hasn't been seen
+            // exiting is gone.
+            Process* procs = (Process*)j->procs->data;
+            for (int i = 0; i < j->procs->len; i++)
+                procs[i]->is_done = true;
+            return;
         }
-    print_err("job_update_status: No process with pid %d\n", pid);
-    return -1;
+        Process p = job_find_process(j, pid);
+        if (p)
+            process_update_status(p, status, &ru);
+    }
 }
 
-void job_update(Job j) {
-    int status;
-    pid_t pid;
-    
-    do
-        pid = waitpid(-j->pgid, &status, WUNTRACED|WNOHANG);
-    while (!job_update_status(j, pid, status));
+void resusage_add(ResUsage total, ResUsage u) {
+    total->user += u->user;
+    total->sys += u->sys;
+    if (u->maxrss > total->maxrss)
+        total->maxrss = u->maxrss;
+    total->majflt += u->majflt;
+    total->nvcsw += u->nvcsw;
+    total->nivcsw += u->nivcsw;
 }
 
-void job_wait(Job j) {
-    int status;
-    pid_t pid;
-    
-    do
-        pid = waitpid(-j->pgid, &status, WUNTRACED);
-    while (!job_update_status(j, pid, status) && !job_is_stopped(j) && !job_is_done(j));
+static ssize_t read_proc_file(const char* path, char* buf, size_t size) {
+    fd_t fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n >= 0)
+        buf[n] = 0;
+    return n;
+}
+
+static long proc_status_field(const char* status, const char* name) {
+    const char* field = strstr(status, name);
+    return field ? strtol(field + strlen(name), NULL, 10) : 0;
+}
+
+// Samples a live process from /proc/<pid>/stat and /proc/<pid>/status.
+// Its max RSS is the VmHWM high-water mark.
+static bool_t process_sample_usage(pid_t pid, ResUsage u) {
+    char path[64], buf[4096];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (read_proc_file(path, buf, sizeof(buf)) <= 0)
+        return false;
+    // The command name can hold spaces and parentheses, so skip past the last ')'.
+    char* fields = strrchr(buf, ')');
+    unsigned long majflt, utime, stime;
+    if (!fields || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %lu %*u %lu %lu", &majflt, &utime, &stime) != 3)
+        return false;
+    long ticks = sysconf(_SC_CLK_TCK);
+    u->user = (uint64_t)utime * 1000000 / ticks;
+    u->sys = (uint64_t)stime * 1000000 / ticks;
+    u->majflt = majflt;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (read_proc_file(path, buf, sizeof(buf)) <= 0)
+        return true;
+    u->maxrss = proc_status_field(buf, "VmHWM:");
+    u->nvcsw = proc_status_field(buf, "\nvoluntary_ctxt_switches:");
+    u->nivcsw = proc_status_field(buf, "nonvoluntary_ctxt_switches:");
+    return true;
+}
+
+// Usage of the job's exited processes plus a sample of the running ones.
+void job_get_usage(Job j, ResUsage u) {
+    *u = j->usage;
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+    {
+        st_ResUsage live = {0};
+        if (procs[i]->pid > 0 && !procs[i]->is_done && process_sample_usage(procs[i]->pid, &live))
+            resusage_add(u, &live);
+    }
+}
+
+void resusage_append(StringBuilder sb, ResUsage u, bool_t verbose) {
+    strbuilder_append_fmt(sb, "user %.2fs, sys %.2fs, rss ", u->user / 1e6, u->sys / 1e6);
+    if (u->maxrss < 1024)
+        strbuilder_append_fmt(sb, "%ldKiB", u->maxrss);
+    else if (u->maxrss < 1024 * 1024)
+        strbuilder_append_fmt(sb, "%.1fMiB", u->maxrss / 1024.0);
+    else
+        strbuilder_append_fmt(sb, "%.2fGiB", u->maxrss / (1024.0 * 1024.0));
+    if (verbose)
+        strbuilder_append_fmt(sb, ", %ld major faults, %ld voluntary and %ld involuntary context switches",
+                              u->majflt, u->nvcsw, u->nivcsw);
+}
+
+typedef bool_t (*thread_func)(pid_t tid, void* arg);
+
+// Parses a CPU list such as "0-3,8". Returns false on a malformed list or
+// one naming no CPU.
+bool_t cpuset_parse(const char* s, cpu_set_t* set) {
+    CPU_ZERO(set);
+    while (*s)
+    {
+        char* end;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+        if (end == s || lo < 0)
+            return false;
+        if (*end == '-')
+        {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo)
+                return false;
+        }
+        if (hi >= CPU_SETSIZE)
+            return false;
+        for (long cpu = lo; cpu <= hi; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return false;
+        s = end;
+    }
+    return CPU_COUNT(set) > 0;
 }
 
-void job_mv_to_bg(Job j, bool_t cont) {
+// Appends set in the form cpuset_parse accepts, with runs collapsed.
+void cpuset_append(StringBuilder sb, cpu_set_t* set) {
+    bool_t first = true;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        strbuilder_append_fmt(sb, first ? "%d" : ",%d", cpu);
+        if (last > cpu)
+            strbuilder_append_fmt(sb, "-%d", last);
+        first = false;
+        cpu = last;
+    }
+}
+
+static int process_for_each_thread(pid_t pid, thread_func fn, void* arg, int* failed) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR* dir = opendir(path);
+    pid_t tid = pid;
+    if (!dir)
+        return fn(tid, arg) ? 1 : (++*failed, 0);
+    int done = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir)))
+    {
+        tid = atoi(ent->d_name);
+        if (tid <= 0)
+            continue;
+        if (fn(tid, arg))
+            done++;
+        else
+            ++*failed;
+    }
+    closedir(dir);
+    return done;
+}
+
+/*
+Calls fn on every thread of every process in the group. Affinity and
+scheduling are per thread, and a running process's children are not in the
+job table, so the group's members are found by scanning /proc. Returns the
+number of threads fn succeeded on, or -1 if /proc could not be read, and
+counts the others in *failed.
+*/
+static int pgrp_for_each_thread(pid_t pgid, thread_func fn, void* arg, int* failed) {
+    DIR* proc = opendir("/proc");
+    if (!proc)
+        return -1;
+    int done = 0;
+    char path[64], buf[1024];
+    struct dirent* ent;
+    while ((ent = readdir(proc)))
+    {
+        pid_t pid = atoi(ent->d_name);
+        if (pid <= 0)
+            continue;
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+        if (read_proc_file(path, buf, sizeof(buf)) <= 0)
+            continue;
+        char* fields = strrchr(buf, ')');
+        int pgrp;
+        if (fields && sscanf(fields + 1, " %*c %*d %d", &pgrp) == 1 && pgrp == pgid)
+            done += process_for_each_thread(pid, fn, arg, failed);
+    }
+    closedir(proc);
+    return done;
+}
+
+/*
+Calls fn on every thread of the job. A job that has been running may have
+started children the job table does not know about, so if it has a group of
+its own the whole group is scanned. Otherwise, and for a job that was only
+just launched, its own processes are enough. A job without its own group
+shares the shell's, which must never be touched.
+*/
+static int job_for_each_thread(Job j, bool_t running, thread_func fn, void* arg, int* failed) {
+    if (running && j->own_pgrp)
+        return pgrp_for_each_thread(j->pgid, fn, arg, failed);
+    int done = 0;
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0 && !procs[i]->is_done)
+            done += process_for_each_thread(procs[i]->pid, fn, arg, failed);
+    return done;
+}
+
+static bool_t thread_set_affinity(pid_t tid, void* set) {
+    return sched_setaffinity(tid, sizeof(cpu_set_t), set) == 0;
+}
+
+// Moves every thread of every process in the group onto set. Returns the
+// number of threads moved, or -1 if /proc could not be read.
+int pgrp_set_affinity(pid_t pgid, cpu_set_t* set) {
+    int failed = 0;
+    return pgrp_for_each_thread(pgid, thread_set_affinity, set, &failed);
+}
+
+// Current affinity of the job's first live process.
+bool_t job_get_affinity(Job j, cpu_set_t* set) {
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (procs[i]->pid > 0 && !procs[i]->is_done && sched_getaffinity(procs[i]->pid, sizeof(cpu_set_t), set) == 0)
+            return true;
+    return false;
+}
+
+// Current scheduling state of the job's first live process.
+bool_t job_get_prio(Job j, SchedPrio prio) {
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+    {
+        pid_t pid = procs[i]->pid;
+        if (pid <= 0 || procs[i]->is_done)
+            continue;
+        int policy = sched_getscheduler(pid);
+        if (policy < 0)
+            continue;
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, pid);
+        if (nice == -1 && errno != 0)
+            continue;
+        prio->policy = policy & ~SCHED_RESET_ON_FORK;
+        prio->nice = nice;
+        prio->ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+        return true;
+    }
+    return false;
+}
+
+void schedprio_append(StringBuilder sb, SchedPrio prio) {
+    static const char* policies[] = {[SCHED_OTHER] = "normal", [SCHED_FIFO] = "fifo", [SCHED_RR] = "rr",
+                                     [SCHED_BATCH] = "batch", [SCHED_IDLE] = "idle"};
+    static const char* ioclasses[] = {[IOPRIO_CLASS_NONE] = "be", [IOPRIO_CLASS_RT] = "rt",
+                                      [IOPRIO_CLASS_BE] = "be", [IOPRIO_CLASS_IDLE] = "idle"};
+    const char* policy = (prio->policy >= 0 && prio->policy <= SCHED_IDLE && policies[prio->policy]) ? policies[prio->policy] : "other";
+    int ioclass = prio->ioprio >= 0 ? prio->ioprio >> IOPRIO_CLASS_SHIFT : IOPRIO_CLASS_NONE;
+    strbuilder_append_fmt(sb, "%s, nice %d, io %s", policy, prio->nice, ioclasses[ioclass & 3]);
+}
+
+static bool_t thread_set_prio(pid_t tid, void* arg) {
+    SchedPrio prio = arg;
+    struct sched_param param = {0};
+    bool_t ok = sched_setscheduler(tid, prio->policy, &param) == 0;
+    ok = (setpriority(PRIO_PROCESS, tid, prio->nice) == 0) && ok;
+    if (prio->ioprio >= 0)
+        ok = (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, prio->ioprio) == 0) && ok;
+    return ok;
+}
+
+/*
+Background jobs make way for the foreground: they run SCHED_BATCH, which
+gives up wakeup preemption, in the idle I/O class, which only gets the disk
+when nobody else wants it. Both can be undone without privileges. bg_nice is
+added to their nice value too, but it is 0 unless the user raised it, since
+only root can lower nice again. Jobs already running under a real-time or
+idle policy were placed there on purpose and are left alone. running says
+whether the job may have started children since its launch.
+*/
+void job_demote(ShellData sd, Job j, bool_t running) {
+    if (j->is_demoted || j->pgid <= 0 || j->prio == JOB_PRIO_NORMAL)
+        return;
+    if (j->prio == JOB_PRIO_DEFAULT && !sd->bg_demote)
+        return;
+    if (!job_get_prio(j, &j->saved))
+        return;
+    if (j->saved.policy != SCHED_OTHER && j->saved.policy != SCHED_BATCH)
+        return;
+
+    st_SchedPrio demoted = {SCHED_BATCH, j->saved.nice + sd->bg_nice, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)};
+    if (demoted.nice > 19)
+        demoted.nice = 19;
+    int failed = 0;
+    if (job_for_each_thread(j, running, thread_set_prio, &demoted, &failed) > 0)
+        j->is_demoted = true;
+}
+
+// If prio -n raised the nice value, lowering it again needs CAP_SYS_NICE or
+// a high enough RLIMIT_NICE. Without them the job keeps its raised nice
+// value, and the user is told.
+void job_restore_prio(Job j) {
+    if (!j->is_demoted)
+        return;
+    j->is_demoted = false;
+    int failed = 0;
+    job_for_each_thread(j, true, thread_set_prio, &j->saved, &failed);
+    if (failed > 0)
+        print_err("(%d) %s: Could not fully restore priority\n", j->pgid, string_get_cstr(j->command));
+}
+
+int64_t timespec_diff_ns(struct timespec* start, struct timespec* stop) {
+    return (int64_t)(stop->tv_sec - start->tv_sec) * 1000000000 + (stop->tv_nsec - start->tv_nsec);
+}
+
+static void report_time_line(jobtime_t timing, const char* stage, int len, const char* name, int64_t real_ns, ResUsage u, int status) {
+    if (timing == JOB_TIME_MACHINE)
+    {
+        print_err("time stage=%s", stage);
+        if (name)
+            print_err(" cmd=%.*s", len, name);
+        print_err(" real_ns=%lld user_us=%llu sys_us=%llu maxrss_kb=%ld", (long long)real_ns,
+                  (unsigned long long)u->user, (unsigned long long)u->sys, u->maxrss);
+        if (status >= 0)
+            print_err(" status=%d", status);
+        print_err("\n");
+    }
+    else
+        print_err("%3lld.%09lld %3llu.%06llu %3llu.%06llu  %.*s\n",
+                  (long long)(real_ns / 1000000000), (long long)(real_ns % 1000000000),
+                  (unsigned long long)(u->user / 1000000), (unsigned long long)(u->user % 1000000),
+                  (unsigned long long)(u->sys / 1000000), (unsigned long long)(u->sys % 1000000),
+                  len, name ? name : stage);
+}
+
+/*
+Prints the report a leading "time" asked for, one line per pipeline stage and
+a total. Wall times run from the launch of the stage, or of the job for the
+total, to the moment the shell reaped it, which for background jobs is the
+next prompt. CPU times come from wait4 or, for stages run inside the shell,
+from getrusage around the builtin.
+*/
+void job_report_time(Job j) {
+    if (j->timing == JOB_TIME_NONE)
+        return;
+
+    struct timespec stop = {0, 0};
+    Process* procs = (Process*)j->procs->data;
+    for (int i = 0; i < j->procs->len; i++)
+        if (timespec_diff_ns(&stop, &procs[i]->finished) > 0)
+            stop = procs[i]->finished;
+    if (stop.tv_sec == 0 && stop.tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (j->timing == JOB_TIME_HUMAN)
+        print_err("%13s %10s %10s\n", "real", "user", "sys");
+    for (int i = 0; i < j->procs->len; i++)
+    {
+        Process p = procs[i];
+        // Stages that never started have no times.
+        int64_t real_ns = 0;
+        if (p->started.tv_sec != 0 && p->finished.tv_sec != 0)
+            real_ns = timespec_diff_ns(&p->started, &p->finished);
+        int status = process_exit_code(p);
+        char stage[16];
+        snprintf(stage, sizeof(stage), "%d", i);
+        report_time_line(j->timing, stage, (int)p->args[0].len, p->line + p->args[0].off, real_ns, &p->usage, status);
+    }
+    report_time_line(j->timing, "total", 5, NULL, timespec_diff_ns(&j->started, &stop), &j->usage, -1);
+}
+
+void job_mv_to_bg(ShellData sd, Job j, bool_t cont) {
+    // Demoted before it resumes, so it never competes at full priority. A
+    // job resumed with bg has been running before.
+    job_demote(sd, j, cont);
     if (cont)
-        warn_failure(kill(-j->pgid, SIGCONT), "%s", "kill");
+        warn_failure(job_kill(j, SIGCONT), "%s", "kill");
 }
 
 void job_mv_to_fg(ShellData sd, Job j, bool_t cont) {
-    struct timeval stop, start;
-    gettimeofday(&start, NULL);
+    // Without a terminal there is nothing to hand over or time for a prompt.
+    if (!sd->interactive)
+    {
+        job_restore_prio(j);
+        if (cont)
+            warn_failure(job_kill(j, SIGCONT), "%s", "kill");
+        j->have_notified = false;
+        job_wait(j);
+        if (job_is_done(j))
+        {
+            j->have_notified = true;
+            job_report_time(j);
+        }
+        return;
+    }
+
+    job_restore_prio(j);
+
+    struct timespec stop, start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     set_terminal_pgrp(sd->shell_terminal, j->pgid);
     
@@ -307,24 +974,34 @@ void job_mv_to_fg(ShellData sd, Job j, bool_t cont) {
     {
         if (j->tmodes)
             set_terminal_attr(sd->shell_terminal, j->tmodes);
-        warn_failure(kill(-j->pgid, SIGCONT), "%s", "kill");
+        warn_failure(job_kill(j, SIGCONT), "%s", "kill");
     }
 
     j->have_notified = false;
 
     job_wait(j);
 
-    gettimeofday(&stop, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
 
-    long timetaken = ((stop.tv_sec - start.tv_sec) * 1000000 + stop.tv_usec - start.tv_usec)/1000000;
+    long timetaken = timespec_diff_ns(&start, &stop) / 1000000000;
     if (timetaken > 2)
     {
-        sd->prev_command->cstr = calloc(4110, sizeof(char));
-        snprintf(sd->prev_command->cstr, 4110,"%s : %lds", string_get_cstr(j->command), timetaken);
+        st_StringBuilder sb;
+        strbuilder_init(&sb, string_get_strlen(j->command) + 24);
+        strbuilder_append(&sb, j->command);
+        strbuilder_append_fmt(&sb, " : %lds (", timetaken);
+        resusage_append(&sb, &j->usage, false);
+        strbuilder_append_cstrn(&sb, ")", 1);
+        if (sd->prev_command)
+            string_delete(sd->prev_command);
+        sd->prev_command = strbuilder_finish(&sb);
     }
 
     if (job_is_done(j))
+    {
         j->have_notified = true;
+        job_report_time(j);
+    }
 
     set_terminal_pgrp(sd->shell_terminal, sd->shell_pgid);
 
@@ -334,39 +1011,61 @@ void job_mv_to_fg(ShellData sd, Job j, bool_t cont) {
     set_terminal_attr(sd->shell_terminal, sd->shell_tmodes);
 }
 
+void joblist_mark_changed(JobList jl, Job j) {
+    if (j->has_changed)
+        return;
+    if (!jl->changed)
+        jl->changed = vector_create(0);
+    j->has_changed = true;
+    vector_append(jl->changed, j);
+}
+
 void joblist_update(JobList jl) {
-    if (!jl || jl->size == 0)
+    if (!jl)
         return;
-    for (JobListNode node = jl->sentinel->next; node != jl->sentinel; )
-    {
-        JobListNode next = NULL;
 
-        job_update(node->job);
+    if (reaper_drain())
+    {
+        int status;
+        struct rusage ru;
+        pid_t pid;
+        while ((pid = wait4(-1, &status, WUNTRACED|WNOHANG, &ru)) > 0)
+        {
+            // Unknown pids belong to jobs that have already been dropped.
+            Process p = joblist_find_process(jl, pid);
+            if (!p)
+                continue;
+            process_update_status(p, status, &ru);
+            joblist_mark_changed(jl, p->job);
+        }
+    }
 
-        if (job_is_done(node->job))
+    if (!jl->changed)
+        return;
+    for (size_t i = 0; i < jl->changed->len; i++)
+    {
+        Job j = jl->changed->data[i];
+        j->has_changed = false;
+        if (job_is_done(j))
         {
-            if (!node->job->have_notified)
+            if (!j->have_notified)
             {
-                print_err("(%d) %s: Done\n", node->job->pgid, string_get_cstr(node->job->command));
-                node->job->have_notified = true;
+                print_err("(%d) %s: Done\n", j->pgid, string_get_cstr(j->command));
+                j->have_notified = true;
+                job_report_time(j);
             }
-            joblist_pop_node(jl, node);
-            next = node->next;
-            joblistnode_delete(node, true);
+            joblist_delete_job(jl, j);
         }
-        else if (job_is_stopped(node->job))
+        else if (job_is_stopped(j))
         {
-            if (!node->job->have_notified)
+            if (!j->have_notified)
             {
-                print_err("(%d) %s: Stopped\n", node->job->pgid, string_get_cstr(node->job->command));
-                node->job->have_notified = true;
+                print_err("(%d) %s: Stopped\n", j->pgid, string_get_cstr(j->command));
+                j->have_notified = true;
             }
         }
-
-        if (!next)
-            next = node->next;
-        node = next;
     }
+    jl->changed->len = 0;
 }
 
 void job_mark_running(Job j) {
@@ -382,23 +1081,19 @@ bool_t job_continue(ShellData sd, pid_t pgid, bool_t isfg) {
         return false;
     job_mark_running(j);
     if (isfg)
+    {
         job_mv_to_fg(sd, j, true);
+        joblist_mark_changed(sd->jobs, j);
+    }
     else
-        job_mv_to_bg(j, true);
+        job_mv_to_bg(sd, j, true);
     return true;
 }
 
 void joblist_kill_all(JobList jl) {
-        if (!jl || jl->size == 0)
+    if (!jl)
         return;
-    for (JobListNode node = jl->sentinel->next; node != jl->sentinel; )
-    {
-        JobListNode next = NULL;
-
-        kill(-node->job->pgid, 9);
-
-        if (!next)
-            next = node->next;
-        node = next;
-    }
+    for (size_t i = 0; i < jl->nslots; i++)
+        if (jl->slots[i])
+            job_kill(jl->slots[i], SIGKILL);
 }
\ No newline at end of file
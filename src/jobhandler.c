@@ -1,7 +1,14 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "shelldata.h"
 #include "utils.h"
@@ -9,6 +16,8 @@
 #include "jobctrl.h"
 #include "vector.h"
 #include "shellcmds.h"
+#include "shellcmdutils.h"
+#include "cmdhash.h"
 
 void set_io(fd_t infd, fd_t outfd, fd_t errfd) {
     if (infd != STDIN_FILENO)
@@ -28,69 +37,220 @@ void set_io(fd_t infd, fd_t outfd, fd_t errfd) {
     }
 }
 
-void run_process(ShellData sd, Process p, pid_t pgid, fd_t infd, fd_t outfd, fd_t errfd, bool_t is_bg) {
+void run_process(ShellData sd, Process p, const st_shellcmd* shellcmd, pid_t pgid, fd_t infd, fd_t outfd, fd_t errfd, bool_t is_bg) {
     pid_t pid = getpid();
     if (pgid == -1)
         pgid = pid;
     
-    setpgid(pid, pgid);
-    if (!is_bg)
+    if (sd->interactive)
+        setpgid(pid, pgid);
+    if (!is_bg && sd->interactive)
         set_terminal_pgrp(sd->shell_terminal, pgid);
+    // Better not to run at all than to run on CPUs the job was kept off.
+    if (p->job && p->job->is_pinned && sched_setaffinity(0, sizeof(cpu_set_t), &p->job->cpus) < 0)
+    {
+        warn_failure(-1, "%s", "pin");
+        exit(EXIT_FAILURE);
+    }
     
     enable_jobctrl_signals();
+    jobctrl_reset_reaper();
 
     set_io(infd, outfd, errfd);
 
-    shellcmd_func runshellcmd;
-    if ((runshellcmd = is_shellcmd(p)))
+    if (shellcmd)
     {
-        runshellcmd(sd, p);
+        process_get_argv(p);
+        shellcmd->cmd_func(sd, p);
         exit(EXIT_SUCCESS);
     }
 
-    execvp((char*)p->argv->data[0], (char**)p->argv->data);
-    if (errno == ENOENT)
-        print_err("%s: command not found\n", (char*)p->argv->data[0]);
+    char** argv = process_get_argv(p);
+    const char* path = cmdhash_lookup(sd->cmds, argv[0]);
+    if (path)
+        execve(path, argv, environ);
+    if (!path || errno == ENOENT)
+        print_err("%s: command not found\n", argv[0]);
     exit(EXIT_FAILURE);
 }
 
+/*
+External commands are resolved through the command hash and started with
+posix_spawn, which glibc implements with
+CLONE_VM|CLONE_VFORK, so launching no longer copies the shell's page tables.
+The child's process group, terminal ownership, signal dispositions and
+stdio are all set up through spawn attributes and file actions. Every other
+descriptor the shell opens for a job is close-on-exec. Builtins that run in
+a child, and pinned jobs, still fork.
+*/
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+// Returns the pid of the started process, or -1 after reporting why it
+// could not be started.
+static pid_t spawn_process(ShellData sd, Process p, pid_t pgid, fd_t infd, fd_t outfd, fd_t errfd, bool_t is_bg) {
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    // Without job control the children stay in the shell's process group,
+    // which is the one the terminal and its Ctrl-C belong to.
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (sd->interactive)
+        flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, pgid == -1 ? 0 : pgid);
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGQUIT);
+    sigaddset(&sigs, SIGTSTP);
+    sigaddset(&sigs, SIGTTIN);
+    sigaddset(&sigs, SIGTTOU);
+    sigaddset(&sigs, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    bool_t take_terminal = (!is_bg && sd->interactive);
+#ifdef HAVE_SPAWN_TCSETPGRP
+    if (take_terminal)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, sd->shell_terminal);
+#endif
+    if (infd != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+    if (outfd != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+    if (errfd != STDERR_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, errfd, STDERR_FILENO);
+
+    char** argv = process_get_argv(p);
+    pid_t pid;
+    const char* path = cmdhash_lookup(sd->cmds, argv[0]);
+    errcode_t err = path ? posix_spawn(&pid, path, &actions, &attr, argv, environ) : ENOENT;
+    // The cached file may have been removed since the table was checked.
+    if (err == ENOENT && path && path != argv[0] && (path = cmdhash_rehash(sd->cmds, argv[0])))
+        err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        if (err == ENOENT)
+            print_err("%s: command not found\n", argv[0]);
+        else
+            print_err("%s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+#ifndef HAVE_SPAWN_TCSETPGRP
+    if (take_terminal)
+        set_terminal_pgrp(sd->shell_terminal, pgid == -1 ? pid : pgid);
+#endif
+    return pid;
+}
+
+static uint64_t rusage_diff_us(struct timeval* before, struct timeval* after) {
+    return (uint64_t)(after->tv_sec - before->tv_sec) * 1000000 + (after->tv_usec - before->tv_usec);
+}
+
+// Runs a builtin in the shell itself with its stdio pointed at infd, outfd
+// and errfd, which are left open for the caller to close.
 void run_forced_shellcmd(ShellData sd, Process p, fd_t infd, fd_t outfd, fd_t errfd, shellcmd_func forced_shellcmd) {
-    fd_t shell_infd = dup(STDIN_FILENO);
-    fd_t shell_outfd = dup(STDOUT_FILENO);
-    fd_t shell_errfd = dup(STDERR_FILENO);
+    fd_t fds[3] = {infd, outfd, errfd};
+    fd_t saved[3] = {-1, -1, -1};
 
-    set_io(infd, outfd, errfd);
+    // Output the shell buffered earlier belongs on its own stdout.
+    fflush(stdout);
+    for (fd_t fd = 0; fd < 3; fd++)
+        if (fds[fd] != fd)
+        {
+            saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+            dup2(fds[fd], fd);
+        }
 
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    process_get_argv(p);
     forced_shellcmd(sd, p);
+    getrusage(RUSAGE_SELF, &after);
 
-    set_io(shell_infd, shell_outfd, shell_errfd);
-    
+    fflush(stdout);
+    fflush(stderr);
+    for (fd_t fd = 0; fd < 3; fd++)
+        if (saved[fd] >= 0)
+        {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+
+    // Charge the builtin's share of the shell's CPU time to its stage. The
+    // shell's max RSS says nothing about the builtin, so it is left out.
+    p->usage.user = rusage_diff_us(&before.ru_utime, &after.ru_utime);
+    p->usage.sys = rusage_diff_us(&before.ru_stime, &after.ru_stime);
+    p->usage.majflt = after.ru_majflt - before.ru_majflt;
+    p->usage.nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    p->usage.nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    if (p->job)
+        resusage_add(&p->job->usage, &p->usage);
+    clock_gettime(CLOCK_MONOTONIC, &p->finished);
+    p->status = 0;
     p->is_done = true;
 }
 
+/*
+Builtins in a foreground job run in the shell when they are forced or
+pipeable, even as a pipeline stage. Such a stage finishes before the next
+one starts, so nothing drains its output while it runs and a pipe would
+fill up and block it. Its output goes to a memfd instead, which is rewound
+to become the next stage's stdin. Builtin-only pipelines never fork, and
+external stages still get real processes and pipes.
+*/
 void run_job(ShellData sd, Job j) {
     fd_t pipefds[2];
     fd_t infd = STDIN_FILENO;
     fd_t outfd = STDOUT_FILENO;
     fd_t errfd = STDERR_FILENO;
 
+    if (j->is_bg && !j->is_pinned && sd->bg_pinned)
+    {
+        j->is_pinned = true;
+        j->cpus = sd->bg_cpus;
+    }
+    j->own_pgrp = sd->interactive;
+    clock_gettime(CLOCK_MONOTONIC, &j->started);
     Process* procs = (Process*)j->procs->data;
     for (int procnum = 0; procnum < j->procs->len; procnum++) {
-        if (procnum + 1 != j->procs->len)
+        const st_shellcmd* shellcmd = shellcmd_find(procs[procnum]);
+        bool_t in_shell = (!j->is_bg && shellcmd && (shellcmd->is_forced || shellcmd->is_pipeable));
+        bool_t buffered = false;
+        fd_t next_infd = STDIN_FILENO;
+        if (procnum + 1 != j->procs->len && in_shell)
         {
-            warn_failure(pipe(pipefds), "%s", "pipe");
+            outfd = memfd_create("yash-stage", MFD_CLOEXEC);
+            warn_failure(outfd, "%s", "memfd_create");
+            next_infd = fcntl(outfd, F_DUPFD_CLOEXEC, 3);
+            buffered = true;
+        }
+        else if (procnum + 1 != j->procs->len)
+        {
+            warn_failure(pipe2(pipefds, O_CLOEXEC), "%s", "pipe");
             outfd = pipefds[1];
+            next_infd = pipefds[0];
         }
         else
             outfd = STDOUT_FILENO;
         
         bool_t skip_process = false;
-        if (procs[procnum]->in)
+        char* fin = process_get_cstr(procs[procnum], &procs[procnum]->in);
+        char* fout = process_get_cstr(procs[procnum], &procs[procnum]->out);
+        char* ferr = process_get_cstr(procs[procnum], &procs[procnum]->err);
+        if (fin)
         {
-            fd_t newinfd = open(procs[procnum]->in, O_RDONLY);
+            fd_t newinfd = open(fin, O_RDONLY | O_CLOEXEC);
             if (newinfd < 0)
             {
-                warn_failure(newinfd, "-yash: %s:", procs[procnum]->in);
+                warn_failure(newinfd, "-yash: %s:", fin);
                 skip_process = true;
             }
             else
@@ -100,15 +260,17 @@ void run_job(ShellData sd, Job j) {
                 infd = newinfd;
             }
         }
-        if (procs[procnum]->out)
+        if (fout)
         {
-            int flags = O_WRONLY | O_CREAT;
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
             if (procs[procnum]->append)
                 flags |= O_APPEND;
-            fd_t newoutfd = open(procs[procnum]->out, flags, 0644);
+            else
+                flags |= O_TRUNC;
+            fd_t newoutfd = open(fout, flags, 0644);
             if (newoutfd < 0)
             {
-                warn_failure(newoutfd, "-yash: %s:", procs[procnum]->out);
+                warn_failure(newoutfd, "-yash: %s:", fout);
                 skip_process = true;
             }
             else
@@ -118,40 +280,62 @@ void run_job(ShellData sd, Job j) {
                 outfd = newoutfd;
             }
         }
-        if (procs[procnum]->err)
+        if (ferr)
         {
-            fd_t newerrfd = open(procs[procnum]->err, O_WRONLY | O_CREAT, 0644);
+            fd_t newerrfd = open(ferr, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
             if (newerrfd < 0)
             {
-                warn_failure(newerrfd, "-yash: %s:", procs[procnum]->err);
+                warn_failure(newerrfd, "-yash: %s:", ferr);
                 skip_process = true;
             }
             else
                 errfd = newerrfd;
         }
 
-        if (!j->is_bg)
+        if (!skip_process)
+            clock_gettime(CLOCK_MONOTONIC, &procs[procnum]->started);
+        if (in_shell && !skip_process)
         {
-            shellcmd_func forced_shellcmd = is_forced_shellcmd(procs[procnum]);
-            if (forced_shellcmd)
+            run_forced_shellcmd(sd, procs[procnum], infd, outfd, errfd, shellcmd->cmd_func);
+            skip_process = true;
+        }
+        // A process that never starts counts as finished, or its job
+        // would wait on it forever.
+        else if (skip_process)
+            procs[procnum]->is_done = true;
+
+        // posix_spawn cannot set an affinity, so pinned jobs fork and pin
+        // themselves before exec.
+        if (!skip_process && !shellcmd && !j->is_pinned)
+        {
+            pid_t pid = spawn_process(sd, procs[procnum], j->pgid, infd, outfd, errfd, j->is_bg);
+            if (pid < 0)
             {
-                run_forced_shellcmd(sd, procs[procnum], infd, outfd, errfd, forced_shellcmd);
-                skip_process = true;
+                procs[procnum]->is_done = true;
+                procs[procnum]->status = W_EXITCODE(EXIT_FAILURE, 0);
+            }
+            else
+            {
+                procs[procnum]->pid = pid;
+                if (j->pgid == -1)
+                    j->pgid = pid;
             }
         }
-
-        if (!skip_process)
+        else if (!skip_process)
         {
+            // Don't let the child replay builtin output still sitting in stdio.
+            fflush(stdout);
             pid_t pid = fork();
             if (pid == 0)
-                run_process(sd, procs[procnum], j->pgid, infd, outfd, errfd, j->is_bg);
+                run_process(sd, procs[procnum], shellcmd, j->pgid, infd, outfd, errfd, j->is_bg);
             else if (pid < 0)
                 warn_failure(-1, "%s", "pid");
             
             procs[procnum]->pid = pid;
             if (j->pgid == -1)
                 j->pgid = pid;
-            setpgid(pid, j->pgid);
+            if (sd->interactive)
+                setpgid(pid, j->pgid);
         }
 
         if (infd != STDIN_FILENO)
@@ -163,32 +347,49 @@ void run_job(ShellData sd, Job j) {
             close(errfd);
             errfd = STDERR_FILENO;
         }
-        infd = pipefds[0];
+        if (buffered)
+            lseek(next_infd, 0, SEEK_SET);
+        infd = next_infd;
     }
 
     if (j->pgid != -1)
     {
         if (j->is_bg)
         {
-            job_mv_to_bg(j, false);
+            job_mv_to_bg(sd, j, false);
             print_err("%d\n", j->pgid);
         }
         else
             job_mv_to_fg(sd, j, false);
     }
     else
+    {
         j->have_notified = true;
+        job_report_time(j);
+    }
 }
 
 void run_jobs(ShellData sd, JobList newjobs) {
     if (!newjobs)
         return;
 
-    for (JobListNode node = newjobs->sentinel->next; node != newjobs->sentinel; node = node->next)
+    // Decided up front: a builtin such as activities may reap and free jobs
+    // of this line that have already finished.
+    st_HistoryRecord meta;
+    String cwd = NULL;
+    bool_t logged = (newjobs->line && !joblist_check_cmd(newjobs, "log"));
+    if (logged)
+        cwd = log_start(sd, newjobs, &meta);
+
+    for (size_t i = 0; i < newjobs->nslots; i++)
     {
-        run_job(sd, node->job);
-        joblist_add_job(sd->jobs, node->job);
+        // An earlier job may have added or removed commands.
+        cmdhash_expire(sd->cmds);
+        run_job(sd, newjobs->slots[i]);
+        joblist_add_job(sd->jobs, newjobs->slots[i]);
     }
 
+    if (logged)
+        log_update(sd, newjobs, &meta, cwd);
     joblist_delete(newjobs, false);
 }
\ No newline at end of file
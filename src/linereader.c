@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "linereader.h"
+
+/*
+Buffered line reader over a file descriptor.
+Lines have no length limit: the buffer doubles whenever a line does not fit.
+Each refill is a single read() for as much as the buffer can hold, so piped
+input hands out many lines per syscall. Returned lines point into the
+reader's buffer, are NUL-terminated in place (the newline is replaced) and
+stay valid until the next call to linereader_next.
+*/
+
+LineReader linereader_create(fd_t fd, size_t buflen) {
+    LineReader lr = malloc(sizeof(st_LineReader));
+    lr->fd = fd;
+    lr->buflen = buflen > 2 ? buflen : LINEREADER_BUFLEN;
+    lr->buf = malloc(lr->buflen);
+    lr->start = 0;
+    lr->end = 0;
+    lr->eof = false;
+    return lr;
+}
+
+// Reader over a fixed string, as for "-c". It never touches a descriptor.
+LineReader linereader_create_str(char* s) {
+    size_t len = strlen(s);
+    LineReader lr = linereader_create(-1, len+1);
+    memcpy(lr->buf, s, len);
+    lr->end = len;
+    lr->eof = true;
+    return lr;
+}
+
+bool_t linereader_has_line(LineReader lr) {
+    return (memchr(lr->buf + lr->start, '\n', lr->end - lr->start) != NULL);
+}
+
+static errcode_t linereader_fill(LineReader lr) {
+    if (lr->start > 0)
+    {
+        memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+        lr->end -= lr->start;
+        lr->start = 0;
+    }
+    // Always keep one spare byte to terminate a final line without a newline.
+    if (lr->end + 1 >= lr->buflen)
+    {
+        lr->buflen *= 2;
+        lr->buf = realloc(lr->buf, lr->buflen);
+    }
+
+    ssize_t nread;
+    do
+        nread = read(lr->fd, lr->buf + lr->end, lr->buflen - lr->end - 1);
+    while (nread < 0 && errno == EINTR);
+
+    if (nread < 0)
+        return -1;
+    if (nread == 0)
+        lr->eof = true;
+    lr->end += nread;
+    return 0;
+}
+
+errcode_t linereader_next(LineReader lr, char** line, size_t* len) {
+    size_t scanned = lr->start;
+    while (true)
+    {
+        char* newl = memchr(lr->buf + scanned, '\n', lr->end - scanned);
+        if (newl)
+        {
+            *newl = 0;
+            *line = lr->buf + lr->start;
+            *len = newl - *line;
+            lr->start = newl - lr->buf + 1;
+            return 0;
+        }
+
+        if (lr->eof)
+        {
+            if (lr->start == lr->end)
+                return -2;
+            lr->buf[lr->end] = 0;
+            *line = lr->buf + lr->start;
+            *len = lr->end - lr->start;
+            lr->start = lr->end;
+            return 0;
+        }
+
+        size_t pending = lr->end - lr->start;
+        if (linereader_fill(lr) < 0)
+            return -1;
+        // Don't rescan bytes already known not to contain a newline.
+        scanned = lr->start + pending;
+    }
+}
+
+void linereader_delete(LineReader lr) {
+    free(lr->buf);
+    free(lr);
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 #define __USE_POSIX
 
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
@@ -12,12 +14,54 @@
 #include "parser.h"
 #include "jobctrl.h"
 #include "jobhandler.h"
+#include "linereader.h"
 
-int main() {
-    ShellData sd = init_shell();
+/*
+Usage:
+    a.out                 interactive when stdin is a terminal, otherwise
+                          runs the commands read from stdin
+    a.out -c "commands"   runs the given commands and exits
+    a.out script          runs the commands in script and exits
+*/
+int main(int argc, char* argv[]) {
+    LineReader reader;
+    bool_t interactive = false;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        if (argc < 3)
+        {
+            print_err("%s: -c: option requires an argument\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        reader = linereader_create_str(argv[2]);
+    }
+    else if (argc > 1)
+    {
+        fd_t scriptfd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (scriptfd < 0)
+        {
+            warn_failure(scriptfd, "%s: %s", argv[0], argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        reader = linereader_create(scriptfd, LINEREADER_BUFLEN);
+    }
+    else
+    {
+        interactive = isatty(STDIN_FILENO);
+        reader = linereader_create(STDIN_FILENO, LINEREADER_BUFLEN);
+    }
+
+    ShellData sd = init_shell(reader, interactive);
 
     while (true)
     {
+        if (!sd->interactive)
+        {
+            run_jobs(sd, parse_batch(sd));
+            joblist_update(sd->jobs);
+            continue;
+        }
+
         display_prompt(sd);
         JobList newjobs = parse_input(sd, NULL);
         // debug_do(joblist_print(sd->jobs));
@@ -1,17 +1,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 #include "mystring.h"
+#include "arena.h"
 
 String string_create(char* cstr, size_t buflen) {
     String str = malloc(sizeof(st_String));
     
     if (!cstr) {
-        if (buflen > 0)
+        if (buflen > sizeof(str->sso))
             str->cstr = malloc(sizeof(char)*buflen);
+        else if (buflen > 0)
+            str->cstr = str->sso;
         else
             str->cstr = NULL;
+        if (str->cstr)
+            str->cstr[0] = 0;
         str->buflen = buflen;
         str->len = 0;
     } else {
@@ -24,10 +30,24 @@ String string_create(char* cstr, size_t buflen) {
     }
 
     str->offset = 0;
-    str->dirty = false;
     return str;
 }
 
+static String string_create_n(const char* s, size_t n) {
+    String str = string_create(NULL, n+1);
+    memcpy(str->cstr, s, n);
+    str->cstr[n] = 0;
+    str->len = n;
+    return str;
+}
+
+// Number of characters actually available in [start, start+offt).
+static size_t string_span_abs(String s, size_t start, size_t offt) {
+    if (start >= s->len)
+        return 0;
+    return (s->len - start < offt) ? s->len - start : offt;
+}
+
 char* string_get_cstr(String s) {
     if (!s || !s->cstr)
         return NULL;
@@ -35,12 +55,9 @@ char* string_get_cstr(String s) {
 }
 
 size_t string_get_strlen(String s) {
-    if (!s->dirty)
-        return s->len;
-    s->dirty = false;
-    if (!string_get_cstr(s))
-        return s->len = 0;
-    return s->len = strlen(string_get_cstr(s));
+    if (!s->cstr || s->offset >= s->len)
+        return 0;
+    return s->len - s->offset;
 }
 
 bool_t string_check_idx(String s, size_t idx) {
@@ -60,7 +77,6 @@ bool_t string_cmp_idx(String s, size_t idx, char c) {
 errcode_t string_set_offset(String s, size_t off) {
     if (!string_check_idx(s, off))
         return -1;
-    s->dirty = true;
     s->offset = off;
     return 0;
 }
@@ -68,14 +84,22 @@ errcode_t string_set_offset(String s, size_t off) {
 errcode_t string_modify(String s, size_t pos, char val) {
     if (!string_check_idx(s, pos))
         return -1;
-    s->dirty = true;
-    s->cstr[s->offset + pos] = val;
+    size_t abspos = s->offset + pos;
+    s->cstr[abspos] = val;
+    if (val == 0 && abspos < s->len)
+        s->len = abspos;
+    else if (val != 0 && abspos == s->len)
+        s->len = abspos + strnlen(s->cstr + abspos, s->buflen - abspos);
     return 0;
 }
 
 errcode_t string_fetch(String s, errcode_t (*funcPtr)(char*, size_t)) {
-    s->dirty = true;
-    return funcPtr(s->cstr, s->buflen);
+    errcode_t ret = funcPtr(s->cstr, s->buflen);
+    s->len = strnlen(s->cstr, s->buflen);
+    // Some fetchers (gethostname) may fill the buffer without terminating it.
+    if (s->len == s->buflen)
+        s->cstr[--s->len] = 0;
+    return ret;
 }
 
 bool_t string_is_prefix(String s, String prefix) {
@@ -85,7 +109,10 @@ bool_t string_is_prefix(String s, String prefix) {
 }
 
 bool_t string_is_equal(String s1, String s2) {
-    return (strcmp(string_get_cstr(s1), string_get_cstr(s2)) == 0);
+    size_t len = string_get_strlen(s1);
+    if (len != string_get_strlen(s2))
+        return false;
+    return (memcmp(string_get_cstr(s1), string_get_cstr(s2), len) == 0);
 }
 
 bool_t string_is_equalc(String s1, char* s2) {
@@ -93,32 +120,53 @@ bool_t string_is_equalc(String s1, char* s2) {
 }
 
 bool_t string_is_prefixc(String s, char* prefix) {
-    String tempstr = string_create(prefix, 0);
-    bool_t ret = string_is_prefix(s, tempstr);
-    free(tempstr);
-    return ret;
+    size_t len = strlen(prefix);
+    if (string_get_strlen(s) < len)
+        return false;
+    return (memcmp(string_get_cstr(s), prefix, len) == 0);
 }
 
 void string_copy(String s1, String s2) {
-    if (!string_check_idx(s1, string_get_strlen(s2)))
+    size_t len = string_get_strlen(s2);
+    if (!string_check_idx(s1, len))
         return;
-    s1->dirty = true;
-    strncpy(string_get_cstr(s1), string_get_cstr(s2), string_get_strlen(s2));
-    string_modify(s1, string_get_strlen(s2), 0);
+    memcpy(string_get_cstr(s1), string_get_cstr(s2), len);
+    s1->cstr[s1->offset + len] = 0;
+    s1->len = s1->offset + len;
 }
 
 void string_copyn(String s1, String s2, size_t n) {
     if (!string_check_idx(s1, n) || !string_check_idx(s2, n-1))
         return;
-    s1->dirty = true;
-    strncpy(string_get_cstr(s1), string_get_cstr(s2), n);
-    string_modify(s1, n, 0);
+    size_t len = string_span_abs(s2, s2->offset, n);
+    memcpy(string_get_cstr(s1), string_get_cstr(s2), len);
+    s1->cstr[s1->offset + len] = 0;
+    s1->len = s1->offset + len;
 }
 
 void string_resize(String s, size_t newsize) {
+    if (s->cstr == s->sso)
+    {
+        if (newsize > sizeof(s->sso))
+        {
+            char* heap = malloc(sizeof(char)*newsize);
+            memcpy(heap, s->sso, s->len+1);
+            s->cstr = heap;
+        }
+    }
+    else
+    {
+        bool_t was_null = (s->cstr == NULL);
+        s->cstr = realloc(s->cstr, sizeof(char)*newsize);
+        if (was_null)
+            s->cstr[0] = 0;
+    }
     s->buflen = newsize;
-    s->cstr = realloc(s->cstr, sizeof(char)*newsize);
-    s->dirty = true;
+    if (s->len >= newsize)
+    {
+        s->len = newsize-1;
+        s->cstr[s->len] = 0;
+    }
 }
 
 void string_set_equal(String s1, String s2) {
@@ -128,59 +176,88 @@ void string_set_equal(String s1, String s2) {
 }
 
 String string_create_copy(String s) {
-    String new = string_create(NULL, string_get_strlen(s)+1);
-    string_copy(new, s);
-    return new;
+    return string_create_n(string_get_cstr(s), string_get_strlen(s));
 }
 
 String string_create_copyc(char* s) {
-    String temp = string_create(s, 0);
-    String ret = string_create_copy(temp);
-    free(temp);
-    return ret;
+    return string_create_n(s, strlen(s));
 }
 
-String string_substr_abs(String s, size_t start, size_t offt) {
-    // printf("%ld - %ld - %ld - %s - %d - %ld - %ld\n", start, offt, s->buflen, s->cstr, s->dirty, s->len, s->offset);
-    if (!string_check_idx(s, start+offt))
-        return NULL;
-    String sub = string_create(NULL, offt+1);
-    size_t prevoff = s->offset;
-    string_set_offset(s, start);
-    string_copyn(sub, s, offt);
-    string_set_offset(s, prevoff);
-    return sub;
-}
-
-char* string_subcstr_abs(String s, size_t start, size_t offt) {
-    String sub = string_substr_abs(s, start, offt);
-    char* ret = sub->cstr;
-    free(sub);
-    return ret;
+String string_create_arena(Arena a, char* s, size_t n) {
+    String str = arena_alloc(a, sizeof(st_String));
+    str->cstr = arena_strndup(a, s, n);
+    str->buflen = n+1;
+    str->len = n;
+    str->offset = 0;
+    return str;
 }
 
 bool_t string_has_csubstr(String s, char* sub) {
     return (strstr(string_get_cstr(s), sub) != NULL);
 }
 
-String string_add(String s1, String s2) {
-    String new = string_create(NULL, string_get_strlen(s1)+string_get_strlen(s2)+1);
-    string_copy(new, s1);
-    string_set_offset(new, string_get_strlen(s1));
-    string_copy(new, s2);
-    string_set_offset(new, 0);
-    return new;
+void string_delete(String s) {
+    if (s && s->cstr != s->sso)
+        free(s->cstr);
+    free(s);
 }
 
-String string_addc(String s1, char* s2) {
-    String tempstr = string_create_copyc(s2);
-    String new = string_add(s1, tempstr);
-    string_delete(tempstr);
-    return new;
+void strbuilder_init(StringBuilder sb, size_t cap) {
+    sb->cap = (cap > STRBUILDER_MIN_CAP) ? cap : STRBUILDER_MIN_CAP;
+    sb->buf = malloc(sizeof(char)*sb->cap);
+    sb->buf[0] = 0;
+    sb->len = 0;
 }
 
-void string_delete(String s) {
-    if (s)
-        free(s->cstr);
-    free(s);
-}
\ No newline at end of file
+static void strbuilder_reserve(StringBuilder sb, size_t extra) {
+    if (sb->len + extra < sb->cap)
+        return;
+    size_t newcap = sb->cap * 2;
+    if (newcap <= sb->len + extra)
+        newcap = sb->len + extra + 1;
+    sb->buf = realloc(sb->buf, sizeof(char)*newcap);
+    sb->cap = newcap;
+}
+
+void strbuilder_append_cstrn(StringBuilder sb, const char* s, size_t n) {
+    strbuilder_reserve(sb, n);
+    memcpy(sb->buf + sb->len, s, n);
+    sb->len += n;
+    sb->buf[sb->len] = 0;
+}
+
+void strbuilder_append_cstr(StringBuilder sb, const char* s) {
+    strbuilder_append_cstrn(sb, s, strlen(s));
+}
+
+void strbuilder_append(StringBuilder sb, String s) {
+    strbuilder_append_cstrn(sb, string_get_cstr(s), string_get_strlen(s));
+}
+
+void strbuilder_append_fmt(StringBuilder sb, const char* fmt, ...) {
+    va_list args, retry;
+    va_start(args, fmt);
+    va_copy(retry, args);
+    int n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, args);
+    if (n >= 0 && sb->len + n >= sb->cap)
+    {
+        strbuilder_reserve(sb, n);
+        vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, retry);
+    }
+    if (n > 0)
+        sb->len += n;
+    sb->buf[sb->len] = 0;
+    va_end(retry);
+    va_end(args);
+}
+
+String strbuilder_finish(StringBuilder sb) {
+    String str = malloc(sizeof(st_String));
+    str->cstr = sb->buf;
+    str->buflen = sb->cap;
+    str->len = sb->len;
+    str->offset = 0;
+    sb->buf = NULL;
+    sb->len = sb->cap = 0;
+    return str;
+}
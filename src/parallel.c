@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "parallel.h"
+#include "shelldata.h"
+#include "mystring.h"
+#include "vector.h"
+#include "cmdhash.h"
+#include "utils.h"
+
+/*
+parallel runs as a forked builtin, so the whole fan-out is one job: its
+commands are spawned into the builtin's own process group, and Ctrl-C,
+Ctrl-Z, fg and bg act on all of them at once. Slots are refilled as soon as
+waitpid reports a command finished. A command killed by SIGINT stops any
+further launches, the way an interrupted loop would. Grouped output goes
+to one memfd per stream and is copied out when the command exits.
+*/
+
+size_t parallel_default_jobs() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+// Expands the template for one argument. Only the expanded words are
+// allocated; *owned has a bit per word that the caller must free.
+static char** parallel_argv(Parallel par, const char* arg, bool_t* owned) {
+    size_t arglen = strlen(arg);
+    bool_t substituted = false;
+    char** argv = malloc(sizeof(char*) * (par->ntmpl + 2));
+    for (size_t i = 0; i < par->ntmpl; i++)
+    {
+        char* word = par->tmpl[i];
+        char* hole = strstr(word, PARALLEL_PLACEHOLDER);
+        owned[i] = (hole != NULL);
+        if (!hole)
+        {
+            argv[i] = word;
+            continue;
+        }
+        st_StringBuilder sb;
+        strbuilder_init(&sb, strlen(word) + arglen);
+        for (; hole; hole = strstr(word, PARALLEL_PLACEHOLDER))
+        {
+            strbuilder_append_cstrn(&sb, word, hole - word);
+            strbuilder_append_cstrn(&sb, arg, arglen);
+            word = hole + strlen(PARALLEL_PLACEHOLDER);
+        }
+        strbuilder_append_cstr(&sb, word);
+        // The builder's buffer is always NUL-terminated, so keep it as is.
+        argv[i] = sb.buf;
+        substituted = true;
+    }
+    size_t argc = par->ntmpl;
+    owned[argc] = false;
+    if (!substituted)
+        argv[argc++] = (char*)arg;
+    argv[argc] = NULL;
+    return argv;
+}
+
+static pid_t parallel_spawn(ShellData sd, Parallel par, ParallelSlot slot) {
+    const char* arg = par->args->data[slot->arg];
+    bool_t owned[par->ntmpl + 1];
+    char** argv = parallel_argv(par, arg, owned);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (par->null_stdin)
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    slot->out = slot->err = -1;
+    if (par->group)
+    {
+        slot->out = memfd_create("yash-parallel", MFD_CLOEXEC);
+        slot->err = memfd_create("yash-parallel", MFD_CLOEXEC);
+        if (slot->out >= 0)
+            posix_spawn_file_actions_adddup2(&actions, slot->out, STDOUT_FILENO);
+        if (slot->err >= 0)
+            posix_spawn_file_actions_adddup2(&actions, slot->err, STDERR_FILENO);
+    }
+
+    pid_t pid = -1;
+    const char* path = cmdhash_lookup(sd->cmds, argv[0]);
+    errcode_t err = path ? posix_spawn(&pid, path, &actions, NULL, argv, environ) : ENOENT;
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0)
+    {
+        if (err == ENOENT)
+            print_err("%s: command not found\n", argv[0]);
+        else
+            print_err("%s: %s\n", argv[0], strerror(err));
+        pid = -1;
+    }
+    for (size_t i = 0; i < par->ntmpl; i++)
+        if (owned[i])
+            free(argv[i]);
+    free(argv);
+    return pid;
+}
+
+static void parallel_copy_out(fd_t from, fd_t to) {
+    if (from < 0)
+        return;
+    char buf[65536];
+    ssize_t n;
+    lseek(from, 0, SEEK_SET);
+    while ((n = read(from, buf, sizeof(buf))) > 0)
+        for (ssize_t off = 0; off < n; )
+        {
+            ssize_t w = write(to, buf + off, n - off);
+            if (w < 0)
+                break;
+            off += w;
+        }
+    close(from);
+}
+
+// Accounts for a finished command. Returns false if it was interrupted.
+static bool_t parallel_finish(Parallel par, ParallelSlot slot, int status) {
+    if (par->group)
+    {
+        parallel_copy_out(slot->out, STDOUT_FILENO);
+        parallel_copy_out(slot->err, STDERR_FILENO);
+    }
+    const char* arg = par->args->data[slot->arg];
+    par->done++;
+    slot->pid = 0;
+    par->running--;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return true;
+    par->failed++;
+    if (WIFSIGNALED(status))
+    {
+        print_err("parallel: %s: Terminated by signal %d\n", arg, WTERMSIG(status));
+        return WTERMSIG(status) != SIGINT;
+    }
+    print_err("parallel: %s: Exited with status %d\n", arg, WEXITSTATUS(status));
+    return true;
+}
+
+void parallel_run(ShellData sd, Parallel par) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    par->slots = calloc(par->maxjobs, sizeof(st_ParallelSlot));
+    par->running = par->done = par->failed = 0;
+    // The builtin's own stdio must not hold grouped output back.
+    fflush(stdout);
+
+    size_t next = 0;
+    bool_t launching = true;
+    while (true)
+    {
+        for (size_t i = 0; i < par->maxjobs && launching && next < par->args->len; i++)
+        {
+            ParallelSlot slot = &par->slots[i];
+            if (slot->pid)
+                continue;
+            slot->arg = next++;
+            slot->pid = parallel_spawn(sd, par, slot);
+            if (slot->pid < 0)
+            {
+                if (par->group)
+                {
+                    close(slot->out);
+                    close(slot->err);
+                }
+                slot->pid = 0;
+                par->done++;
+                par->failed++;
+                continue;
+            }
+            par->running++;
+        }
+        if (par->running == 0)
+            break;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            warn_failure(-1, "%s", "waitpid");
+            break;
+        }
+        for (size_t i = 0; i < par->maxjobs; i++)
+            if (par->slots[i].pid == pid)
+            {
+                if (!parallel_finish(par, &par->slots[i], status))
+                    launching = false;
+                break;
+            }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    print_err("parallel: %ld of %ld jobs in %.2fs (%.1f jobs/s), %ld failed\n", par->done, par->args->len,
+              secs, secs > 0 ? par->done / secs : 0.0, par->failed);
+    free(par->slots);
+    par->slots = NULL;
+}
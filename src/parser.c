@@ -2,20 +2,27 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <ctype.h>
 
 #include "mystring.h"
-#include "wrappers.h"
+#include "linereader.h"
 #include "utils.h"
 #include "jobctrl.h"
 #include "parser.h"
 #include "vector.h"
-#include "vecutils.h"
 #include "shellcmdutils.h"
 #include "shelldata.h"
+#include "arena.h"
+#include "tokenizer.h"
 
-#define INPUT_MAX 4096
+// Scratch space reused across lines; finished arg and proc lists are
+// copied into the line's arena at their final size.
+static Token scratch_args = NULL;
+static size_t scratch_args_len = 0;
+static Vector scratch_procs = NULL;
 
 void exit_shell(ShellData sd) {
     joblist_kill_all(sd->jobs);
@@ -23,17 +30,29 @@ void exit_shell(ShellData sd) {
     exit(EXIT_SUCCESS);
 }
 
+// View over the reader's current line, reused for every prompt.
+static st_String input_line;
+
 String get_input(ShellData sd) {
-    String input = string_create(NULL, INPUT_MAX+1);
-    int retval = string_fetch(input, wrap_fgets);
+    char* line;
+    size_t len;
+    // The reader bypasses stdio, so push out the prompt first.
+    fflush(stdout);
+    errcode_t retval = linereader_next(sd->reader, &line, &len);
     if (retval == -1)
-        warn_failure(-1, "%s", "wrap_fgets");
-    else if (retval == -2)
     {
-        string_delete(input);
-        exit_shell(sd);
+        warn_failure(-1, "%s", "read");
+        line = "";
+        len = 0;
     }
-    return input;
+    else if (retval == -2)
+        exit_shell(sd);
+
+    input_line.cstr = line;
+    input_line.buflen = len+1;
+    input_line.len = len;
+    input_line.offset = 0;
+    return &input_line;
 }
 
 bool_t is_whitespace(char c) {
@@ -45,116 +64,177 @@ bool_t is_whitespace(char c) {
 }
 
 void parse_whitespace(String input) {
-    size_t iter = input->offset;
     size_t stop = input->offset + string_get_strlen(input);
-    while (iter < stop && is_whitespace(input->cstr[iter]))
-        iter++;
-    string_set_offset(input, iter);
+    string_set_offset(input, scan_whitespace(input->cstr, input->offset, stop));
 }
 
-st_parser_ret parse_process(String input) {
-    Vector argv = vector_create(0);
-    size_t iter = input->offset;
-    size_t stop = input->offset + string_get_strlen(input);
+st_parser_ret parse_process(Tokenizer tz, Arena a) {
+    size_t argc = 0;
     bool_t is_in = false;
     bool_t is_out = false;
     bool_t is_append = false;
     errcode_t err = 0;
-    char *fin = NULL, *fout = NULL, *ferr = NULL;
-    while (iter < stop)
+    st_Token fin = {TOK_END, 0, 0}, fout = {TOK_END, 0, 0};
+    while (true)
     {
-        parse_whitespace(input);
-        iter = input->offset;
-        if (iter == stop)
-            break;
-        
-        size_t start = iter;
-        while (iter < stop && input->cstr[iter] != '|' &&\
-                               input->cstr[iter] != ';' &&\
-                               input->cstr[iter] != '&' &&\
-                               input->cstr[iter] != '>' &&\
-                               input->cstr[iter] != '<' &&\
-                               !is_whitespace(input->cstr[iter]))
-            iter++;
-        
-        if (iter-start > 0)
+        Token tok = tokenizer_peek(tz);
+        if (tok->type == TOK_WORD)
         {
-            char* tok = string_subcstr_abs(input, start, iter-start);
             if (is_in)
             {
-                fin = tok;
+                fin = *tok;
                 is_in = false;
             }
             else if (is_out)
             {
-                fout = tok;
+                fout = *tok;
                 is_out = false;
-                is_append = false;
             }
             else
-                vector_append(argv, tok);
+            {
+                if (argc == scratch_args_len)
+                {
+                    scratch_args_len = scratch_args_len ? scratch_args_len*2 : 16;
+                    scratch_args = realloc(scratch_args, sizeof(st_Token)*scratch_args_len);
+                }
+                scratch_args[argc++] = *tok;
+            }
         }
-        else if (iter < stop && input->cstr[iter] == '<')
+        else if (tok->type == TOK_IN)
         {
-            if (is_in || is_out || argv->len == 0)
+            if (is_in || is_out || argc == 0)
             {
                 err = 1;
                 break;
             }
-            iter++;
             is_in = true;
         }
-        else if (iter < stop && input->cstr[iter] == '>')
+        else if (tok->type == TOK_OUT || tok->type == TOK_APPEND)
         {
-            if (is_in || is_out || argv->len == 0)
+            if (is_in || is_out || argc == 0)
             {
                 err = 1;
                 break;
             }
-            iter++;
             is_out = true;
-            if (iter < stop && input->cstr[iter] == '>')
-            {
-                iter++;
-                is_append = true;
-            }
+            is_append = (tok->type == TOK_APPEND);
         }
         else
             break;
-        string_set_offset(input, iter);
+        tokenizer_next(tz);
     }
 
-    if (err != 0 || argv->len == 0)
+    // A redirect with no filename after it.
+    if (err == 0 && (is_in || is_out))
+        err = 1;
+
+    if (err != 0 || argc == 0)
     {
-        vector_free_cstr(argv);
-        vector_delete(argv);
         st_parser_ret ret;
         ret.data = NULL;
         ret.err = err;
         return ret;
     }
 
+    Token args = arena_alloc(a, sizeof(st_Token)*argc);
+    memcpy(args, scratch_args, sizeof(st_Token)*argc);
+
     st_parser_ret ret;
-    ret.data = process_create(argv);
+    ret.data = process_create(a, tz->buf, args, argc);
     ((Process)ret.data)->in = fin;
     ((Process)ret.data)->out = fout;
-    ((Process)ret.data)->err = ferr;
     ((Process)ret.data)->append = is_append;
     ret.err = err;
     return ret;
 }
 
-st_parser_ret parse_job(String input) {
-    Vector procs = vector_create(0);
-    size_t iter = input->offset;
-    size_t cmdstart = iter;
-    size_t stop = input->offset + string_get_strlen(input);
+static bool_t token_is(Tokenizer tz, Token tok, const char* word) {
+    return tok->type == TOK_WORD && tok->len == strlen(word) && strncmp(tz->buf + tok->off, word, tok->len) == 0;
+}
+
+// A leading "time", optionally followed by -m, times the rest of the job.
+static jobtime_t parse_time_prefix(Tokenizer tz) {
+    if (!token_is(tz, tokenizer_peek(tz), "time"))
+        return JOB_TIME_NONE;
+    tokenizer_next(tz);
+    if (!token_is(tz, tokenizer_peek(tz), "-m"))
+        return JOB_TIME_HUMAN;
+    tokenizer_next(tz);
+    return JOB_TIME_MACHINE;
+}
+
+// A leading "pin" followed by a CPU list confines the job to those CPUs.
+// Without a list that starts with a digit, pin is the builtin instead.
+static errcode_t parse_pin_prefix(Tokenizer tz, Arena a, bool_t* pinned, cpu_set_t* cpus) {
+    if (!token_is(tz, tokenizer_peek(tz), "pin"))
+        return 0;
+    st_Tokenizer saved = *tz;
+    tokenizer_next(tz);
+    Token tok = tokenizer_peek(tz);
+    if (tok->type != TOK_WORD || !isdigit((unsigned char)tz->buf[tok->off]))
+    {
+        *tz = saved;
+        return 0;
+    }
+    char* list = arena_strndup(a, tz->buf + tok->off, tok->len);
+    if (!cpuset_parse(list, cpus))
+    {
+        print_err("pin: Invalid CPU list %s.\n", list);
+        return 2;
+    }
+    tokenizer_next(tz);
+    *pinned = true;
+    return 0;
+}
+
+// A leading "prio batch" or "prio normal" overrides whether the job is
+// demoted in the background. Anything else leaves prio to the builtin.
+static jobprio_t parse_prio_prefix(Tokenizer tz) {
+    if (!token_is(tz, tokenizer_peek(tz), "prio"))
+        return JOB_PRIO_DEFAULT;
+    st_Tokenizer saved = *tz;
+    tokenizer_next(tz);
+    if (token_is(tz, tokenizer_peek(tz), "batch"))
+    {
+        tokenizer_next(tz);
+        return JOB_PRIO_BATCH;
+    }
+    if (token_is(tz, tokenizer_peek(tz), "normal"))
+    {
+        tokenizer_next(tz);
+        return JOB_PRIO_NORMAL;
+    }
+    *tz = saved;
+    return JOB_PRIO_DEFAULT;
+}
+
+st_parser_ret parse_job(Tokenizer tz, Arena a) {
+    if (!scratch_procs)
+        scratch_procs = vector_create(0);
+    Vector procs = scratch_procs;
+    procs->len = 0;
     bool_t need_job = false;
     bool_t is_bg = false;
+    bool_t pinned = false;
+    cpu_set_t cpus;
+    jobtime_t timing = JOB_TIME_NONE;
+    jobprio_t prio = JOB_PRIO_DEFAULT;
     errcode_t err = 0;
-    while (iter < stop)
+    // Prefixes may come in any order, each at most once.
+    while (err == 0)
     {
-        st_parser_ret ret = parse_process(input);
+        if (timing == JOB_TIME_NONE && (timing = parse_time_prefix(tz)) != JOB_TIME_NONE)
+            continue;
+        if (!pinned && (err = parse_pin_prefix(tz, a, &pinned, &cpus)) == 0 && pinned)
+            continue;
+        if (prio == JOB_PRIO_DEFAULT && (prio = parse_prio_prefix(tz)) != JOB_PRIO_DEFAULT)
+            continue;
+        break;
+    }
+    size_t cmdstart = tokenizer_peek(tz)->off;
+    while (err == 0)
+    {
+        st_parser_ret ret = parse_process(tz, a);
         if (!ret.data)
         {
             if (ret.err != 0)
@@ -169,19 +249,22 @@ st_parser_ret parse_job(String input) {
             }
             else
             {
-                iter = input->offset;
-                if (iter < stop && (input->cstr[iter] == '|'))
+                Token tok = tokenizer_peek(tz);
+                if (tok->type == TOK_PIPE)
                 {
+                    if (procs->len == 0)
+                    {
+                        err = 1;
+                        break;
+                    }
                     need_job = true;
-                    iter++;
-                    string_set_offset(input, iter);
+                    tokenizer_next(tz);
                     continue;
                 }
-                else if (iter < stop && (input->cstr[iter] == '&'))
+                else if (tok->type == TOK_AMP)
                 {
                     is_bg = true;
-                    iter++;
-                    string_set_offset(input, iter);
+                    tokenizer_next(tz);
                     break;
                 }
                 else
@@ -190,14 +273,14 @@ st_parser_ret parse_job(String input) {
         }
         if (need_job)
             need_job = false;
-        vector_append(((Process)ret.data)->argv, NULL);
         vector_append(procs, ret.data);
     }
 
+    // A prefix on its own has nothing to apply to.
+    if (err == 0 && procs->len == 0 && (timing != JOB_TIME_NONE || pinned || prio != JOB_PRIO_DEFAULT))
+        err = 1;
     if (err != 0 || procs->len == 0)
     {
-        vector_free_process(procs);
-        vector_delete(procs);
         st_parser_ret ret;
         ret.data = NULL;
         ret.err = err;
@@ -205,28 +288,30 @@ st_parser_ret parse_job(String input) {
     }
 
     st_parser_ret ret;
-    ret.data = job_create(string_substr_abs(input, cmdstart, iter-cmdstart), procs);
+    ret.data = job_create(a, string_create_arena(a, tz->buf+cmdstart, tz->prev_end-cmdstart), vector_create_arena(a, procs));
     ((Job)ret.data)->is_bg = is_bg;
+    ((Job)ret.data)->timing = timing;
+    ((Job)ret.data)->is_pinned = pinned;
+    ((Job)ret.data)->prio = prio;
+    if (pinned)
+        ((Job)ret.data)->cpus = cpus;
     ret.err = 0;
     return ret;
 }
 
-JobList parse_input(ShellData sd, String input) {
-    bool_t freeinput = false;
-    if (!input)
-    {
-        input = get_input(sd);
-        freeinput = true;
-    }
-    else
-        string_resize(input, 4097);
-    string_modify(input, string_get_strlen(input)-1, 0);
-    
-    JobList jl = joblist_create();
+// Parses one line into jl. On a syntax error the jobs already added for this
+// line are dropped again, so a line is either accepted or rejected whole.
+errcode_t parse_line(JobList jl, String input) {
+    size_t prevsize = jl->size;
+
+    // Jobs keep spans into this copy of the line instead of copying tokens.
+    st_Tokenizer tz;
+    tokenizer_init(&tz, arena_strndup(jl->arena, string_get_cstr(input), string_get_strlen(input)), string_get_strlen(input));
+
     errcode_t err = 0;
-    while (string_get_strlen(input) > 0)
+    while (tokenizer_peek(&tz)->type != TOK_END)
     {
-        st_parser_ret ret = parse_job(input);
+        st_parser_ret ret = parse_job(&tz, jl->arena);
         if (!ret.data)
         {
             if (ret.err != 0)
@@ -234,30 +319,66 @@ JobList parse_input(ShellData sd, String input) {
                 err = ret.err;
                 break;
             }
-            else if (input->cstr[input->offset] == ';')
-            {
-                input->offset++;
-                continue;
-            }
-            else
-                break;
+            else if (tokenizer_peek(&tz)->type == TOK_SEMI)
+                tokenizer_next(&tz);
+            continue;
         }
         joblist_add_job(jl, ret.data);
     }
 
-    if (err != 0 || jl->size == 0) {
-        joblist_delete(jl, true);
+    if (err != 0)
+    {
+        while (jl->size > prevsize)
+            joblist_delete_job(jl, joblist_last(jl));
         if (err == 1)
-            print_err("Syntax Error: found unexpected token at position %ld\n", input->offset);
-        string_delete(input);
+            print_err("Syntax Error: found unexpected token at position %ld\n", tokenizer_peek(&tz)->off);
+    }
+    return err;
+}
+
+JobList parse_input(ShellData sd, String input) {
+    if (!input)
+        input = get_input(sd);
+    else if (string_get_strlen(input) > 0 && string_cmp_idx(input, string_get_strlen(input)-1, '\n'))
+        string_modify(input, string_get_strlen(input)-1, 0);
+
+    JobList jl = joblist_create();
+    jl->arena = arena_create(ARENA_BLOCK_SIZE + string_get_strlen(input)*4);
+
+    if (parse_line(jl, input) != 0 || jl->size == 0) {
+        joblist_delete(jl, true);
         return NULL;
     }
 
-    string_set_offset(input, 0);
-    log_update(sd, input, jl);
+    // Kept for the history, which is written once the line has run.
+    if (sd->interactive)
+        jl->line = string_create_arena(jl->arena, string_get_cstr(input), string_get_strlen(input));
+
+    return jl;
+}
+
+// Non-interactive counterpart of parse_input. Every complete line the reader
+// already holds is parsed into a single job list sharing one arena, so a
+// script pays for reading and reaping once per buffer rather than per line.
+JobList parse_batch(ShellData sd) {
+    String input = get_input(sd);
+    size_t buffered = sd->reader->end - sd->reader->start;
+
+    JobList jl = joblist_create();
+    jl->arena = arena_create(ARENA_BLOCK_SIZE + (string_get_strlen(input) + buffered)*4);
 
-    if (freeinput)
-        string_delete(input);
+    while (true)
+    {
+        parse_line(jl, input);
+        if (!linereader_has_line(sd->reader))
+            break;
+        input = get_input(sd);
+    }
+
+    if (jl->size == 0) {
+        joblist_delete(jl, true);
+        return NULL;
+    }
 
     return jl;
 }
\ No newline at end of file
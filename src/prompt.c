@@ -4,11 +4,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 #include "mystring.h"
 #include "utils.h"
 #include "wrappers.h"
 #include "shelldata.h"
+#include "prompt.h"
 
 #define PATH_MAX 4096
 #define NAME_MAX 32
@@ -31,30 +33,76 @@ String get_path() {
     return path;
 }
 
-void display_prompt(ShellData sd) {
-    String username = get_username();
-    String hostname = get_hostname();
-    String path = get_path();
-    
+/*
+The rendered prompt is cached in ShellData. The user@host part never
+changes, so it is looked up once (getpwuid can be slow behind NSS). The cwd,
+which the history also records, is looked up again only after
+prompt_invalidate. Every builtin that changes the shell's cwd calls it.
+*/
+static String prompt_render(ShellData sd) {
+    st_StringBuilder sb;
+
+    if (!sd->prompt_ident)
+    {
+        String username = get_username();
+        String hostname = get_hostname();
+        strbuilder_init(&sb, 0);
+        strbuilder_append_fmt(&sb, "<" GRN "%s@%s" CRESET ":" BLU, string_get_cstr(username), string_get_cstr(hostname));
+        sd->prompt_ident = strbuilder_finish(&sb);
+        string_delete(username);
+        string_delete(hostname);
+    }
+
+    String path = prompt_get_cwd(sd);
+    size_t homelen = string_get_strlen(sd->home_dir_path);
+
+    strbuilder_init(&sb, string_get_strlen(sd->prompt_ident) + string_get_strlen(path) + sizeof(CRESET));
+    strbuilder_append(&sb, sd->prompt_ident);
     if (string_is_prefix(path, sd->home_dir_path)) {
-        warn_failure(string_set_offset(path, string_get_strlen(sd->home_dir_path)-1), "%s", "string_set_offset");
-        warn_failure(string_modify(path, 0, '~'), "%s", "string_modify");
+        strbuilder_append_cstrn(&sb, "~", 1);
+        strbuilder_append_cstrn(&sb, string_get_cstr(path) + homelen, string_get_strlen(path) - homelen);
     }
+    else
+        strbuilder_append(&sb, path);
+    strbuilder_append_cstrn(&sb, CRESET, sizeof(CRESET)-1);
+    return strbuilder_finish(&sb);
+}
+
+// The shell's cwd, looked up again only after prompt_invalidate.
+String prompt_get_cwd(ShellData sd) {
+    if (!sd->cwd)
+        sd->cwd = get_path();
+    return sd->cwd;
+}
 
-    if (string_get_cstr(sd->prev_command) != NULL) {
-        printf("<" GRN "%s@%s" CRESET ":" BLU "%s" CRESET " %s> ", string_get_cstr(username),\
-                                                                   string_get_cstr(hostname),\
-                                                                   string_get_cstr(path),\
-                                                                   string_get_cstr(sd->prev_command));
-        free(sd->prev_command->cstr);
-        sd->prev_command->cstr = NULL;
-    } else {
-        printf("<" GRN "%s@%s" CRESET ":" BLU "%s" CRESET "> ", string_get_cstr(username),\
-                                                                string_get_cstr(hostname),\
-                                                                string_get_cstr(path));
+void prompt_invalidate(ShellData sd) {
+    if (sd->prompt)
+        string_delete(sd->prompt);
+    if (sd->cwd)
+        string_delete(sd->cwd);
+    sd->prompt = NULL;
+    sd->cwd = NULL;
+}
+
+void display_prompt(ShellData sd) {
+    if (!sd->prompt)
+        sd->prompt = prompt_render(sd);
+
+    struct iovec iov[4];
+    int iovcnt = 0;
+    iov[iovcnt++] = (struct iovec){string_get_cstr(sd->prompt), string_get_strlen(sd->prompt)};
+    if (sd->prev_command) {
+        iov[iovcnt++] = (struct iovec){" ", 1};
+        iov[iovcnt++] = (struct iovec){string_get_cstr(sd->prev_command), string_get_strlen(sd->prev_command)};
     }
+    iov[iovcnt++] = (struct iovec){"> ", 2};
 
-    string_delete(username);
-    string_delete(hostname);
-    string_delete(path);
-}
\ No newline at end of file
+    // Anything a builtin left in stdio has to reach the terminal first.
+    fflush(stdout);
+    warn_failure(writev(STDOUT_FILENO, iov, iovcnt), "%s", "writev");
+
+    if (sd->prev_command) {
+        string_delete(sd->prev_command);
+        sd->prev_command = NULL;
+    }
+}
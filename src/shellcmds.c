@@ -33,49 +33,135 @@
 #include "prompt.h"
 #include "argparse.h"
 #include "shellcmdutils.h"
+#include "history.h"
 #include "parser.h"
+#include "cmdhash.h"
+#include "parallel.h"
+#include "bench.h"
+#include "linereader.h"
 
 #include "shellcmds.h"
 
-// List of shell builtins
-const st_shellcmd shellcmd_list[] = {{cmd_hop, "hop"},
-                                     {cmd_reveal, "reveal"},
-                                     {cmd_log, "log"},
-                                     {cmd_proclore, "proclore"},
-                                     {cmd_seek, "seek"},
-                                     {cmd_activities, "activities"},
-                                     {cmd_ping, "ping"},
-                                     {cmd_fg, "fg"},
-                                     {cmd_bg, "bg"},
-                                     {cmd_neonate, "neonate"},
-                                     {cmd_iMan, "iMan"}};
-const size_t num_shellcmds = sizeof(shellcmd_list)/sizeof(st_shellcmd);
-// List of shell builtins which should not be run in a subshell
-// if they are not background processes.
-const st_shellcmd forced_shellcmd_list[] = {{cmd_hop, "hop"},
-                                            {cmd_log, "log"},
-                                            {cmd_seek, "seek"},
-                                            {cmd_ping, "ping"},
-                                            {cmd_fg, "fg"},
-                                            {cmd_bg, "bg"}};
-const size_t num_forced_shellcmds = sizeof(forced_shellcmd_list)/sizeof(st_shellcmd);
-
-shellcmd_func is_shellcmd(Process p) {
-    for (size_t i = 0; i < num_shellcmds; i++)
-    {
-        if (strcmp(p->argv->data[0], shellcmd_list[i].cmd_name) == 0)
-            return shellcmd_list[i].cmd_func;
-    }
-    return NULL;
-}
-
-shellcmd_func is_forced_shellcmd(Process p) {
-    for (size_t i = 0; i < num_forced_shellcmds; i++)
+enum {
+    SC_HOP,
+    SC_REVEAL,
+    SC_LOG,
+    SC_PROCLORE,
+    SC_SEEK,
+    SC_ACTIVITIES,
+    SC_PING,
+    SC_FG,
+    SC_BG,
+    SC_NEONATE,
+    SC_IMAN,
+    SC_HASH,
+    SC_PARALLEL,
+    SC_BENCH,
+    SC_PIN,
+    SC_PRIO
+};
+
+// List of shell builtins. is_forced marks builtins which should not be run
+// in a subshell if they are not background processes. is_pipeable marks the
+// others that finish quickly without the terminal, so they may also run in
+// the shell itself, as a stage of a foreground pipeline or on their own.
+static const st_shellcmd shellcmd_list[] = {[SC_HOP]        = {cmd_hop, "hop", true, false},
+                                            [SC_REVEAL]     = {cmd_reveal, "reveal", false, true},
+                                            [SC_LOG]        = {cmd_log, "log", true, false},
+                                            [SC_PROCLORE]   = {cmd_proclore, "proclore", false, true},
+                                            [SC_SEEK]       = {cmd_seek, "seek", true, false},
+                                            [SC_ACTIVITIES] = {cmd_activities, "activities", false, true},
+                                            [SC_PING]       = {cmd_ping, "ping", true, false},
+                                            [SC_FG]         = {cmd_fg, "fg", true, false},
+                                            [SC_BG]         = {cmd_bg, "bg", true, false},
+                                            [SC_NEONATE]    = {cmd_neonate, "neonate", false, false},
+                                            [SC_IMAN]       = {cmd_iMan, "iMan", false, false},
+                                            [SC_HASH]       = {cmd_hash, "hash", true, false},
+                                            [SC_PARALLEL]   = {cmd_parallel, "parallel", false, false},
+                                            [SC_BENCH]      = {cmd_bench, "bench", true, false},
+                                            [SC_PIN]        = {cmd_pin, "pin", true, false},
+                                            [SC_PRIO]       = {cmd_prio, "prio", true, false}};
+
+// Option specs of the builtins. Positional arguments are listed in order.
+static const st_ArgSpec reveal_args   = {ARG_FLAG('l') | ARG_FLAG('a'), 0, 1};                  // path
+static const st_ArgSpec log_args      = {0, 0, 2};                                              // command, index
+static const st_ArgSpec proclore_args = {0, 0, 1};                                              // pid
+static const st_ArgSpec seek_args     = {ARG_FLAG('d') | ARG_FLAG('f') | ARG_FLAG('e'), 0, 2};  // target, searchdir
+static const st_ArgSpec ping_args     = {0, 0, 2};                                              // pid, signal_number
+static const st_ArgSpec fgbg_args     = {0, 0, 1};                                              // pid
+static const st_ArgSpec neonate_args  = {0, ARG_FLAG('n'), 0};
+static const st_ArgSpec iman_args     = {0, 0, 3};                                              // cmd, and two ignored
+static const st_ArgSpec hash_args     = {ARG_FLAG('r'), 0, ARG_MAX_POSIT};                      // names
+static const st_ArgSpec activities_args = {ARG_FLAG('v'), 0, 0};
+static const st_ArgSpec pin_args      = {0, ARG_FLAG('p') | ARG_FLAG('d'), 1};                  // cpus
+static const st_ArgSpec prio_args     = {0, ARG_FLAG('d') | ARG_FLAG('n') | ARG_FLAG('p'), 1};  // batch, normal or default
+
+/*
+Builtins are dispatched on name length and first character, which picks at
+most one candidate, and a single compare confirms it. Every external command
+therefore costs one switch and at most one memcmp rather than a strcmp per
+builtin. When adding a builtin whose length and first character collide
+with an existing one, chain a second compare for that case.
+*/
+const st_shellcmd* shellcmd_lookup(const char* name, size_t len) {
+    int idx = -1;
+    switch (len)
     {
-        if (strcmp(p->argv->data[0], forced_shellcmd_list[i].cmd_name) == 0)
-            return forced_shellcmd_list[i].cmd_func;
+        case 2:
+            if (name[0] == 'f')
+                idx = SC_FG;
+            else if (name[0] == 'b')
+                idx = SC_BG;
+            break;
+        case 3:
+            if (name[0] == 'h')
+                idx = SC_HOP;
+            else if (name[0] == 'l')
+                idx = SC_LOG;
+            else if (name[0] == 'p')
+                idx = SC_PIN;
+            break;
+        case 4:
+            if (name[0] == 's')
+                idx = SC_SEEK;
+            else if (name[0] == 'p')
+                idx = (name[1] == 'i') ? SC_PING : SC_PRIO;
+            else if (name[0] == 'i')
+                idx = SC_IMAN;
+            else if (name[0] == 'h')
+                idx = SC_HASH;
+            break;
+        case 5:
+            if (name[0] == 'b')
+                idx = SC_BENCH;
+            break;
+        case 6:
+            if (name[0] == 'r')
+                idx = SC_REVEAL;
+            break;
+        case 7:
+            if (name[0] == 'n')
+                idx = SC_NEONATE;
+            break;
+        case 8:
+            if (name[0] == 'p')
+                idx = (name[1] == 'r') ? SC_PROCLORE : SC_PARALLEL;
+            break;
+        case 10:
+            if (name[0] == 'a')
+                idx = SC_ACTIVITIES;
+            break;
     }
-    return NULL;
+
+    if (idx < 0 || memcmp(shellcmd_list[idx].cmd_name, name, len) != 0)
+        return NULL;
+    return &shellcmd_list[idx];
+}
+
+const st_shellcmd* shellcmd_find(Process p) {
+    if (p->argc == 0)
+        return NULL;
+    return shellcmd_lookup(p->line + p->args[0].off, p->args[0].len);
 }
 
 void cmd_hop(ShellData sd, Process p) {
@@ -87,6 +173,7 @@ void cmd_hop(ShellData sd, Process p) {
         {
             printf("%s\n", string_get_cstr(sd->home_dir_path));
             string_set_equal(sd->prev_path, curr_path);
+            prompt_invalidate(sd);
         }
         else
             warn_failure(-1, "%s", "chdir");
@@ -104,6 +191,7 @@ void cmd_hop(ShellData sd, Process p) {
             printf("%s\n", string_get_cstr(new_path));
             string_set_equal(sd->prev_path, curr_path);
             string_delete(new_path);
+            prompt_invalidate(sd);
         }
         else
             warn_failure(-1, "%s", "chdir");
@@ -113,18 +201,18 @@ void cmd_hop(ShellData sd, Process p) {
 }
 
 void cmd_reveal(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("-l,-a,path"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&reveal_args, p->argv, &argtab) < 0)
         return;
     
-    String path = argtable_get_pos_arg(argtab, "path");
+    char* path = argtable_get_pos_arg(&argtab, 0);
     String parsedpath;
     if (!path)
         parsedpath = string_create_copyc(".");
     else
-        parsedpath = parse_path(sd, string_get_cstr(path));
-    bool_t is_lflag = argtable_is_flag_set(argtab, 'l');
-    bool_t is_aflag = argtable_is_flag_set(argtab, 'a');
+        parsedpath = parse_path(sd, path);
+    bool_t is_lflag = argtable_is_flag_set(&argtab, 'l');
+    bool_t is_aflag = argtable_is_flag_set(&argtab, 'a');
 
     struct dirent** namelist;
     errcode_t numdirs = scandir(string_get_cstr(parsedpath), &namelist, NULL, alphasort);
@@ -141,7 +229,6 @@ void cmd_reveal(ShellData sd, Process p) {
                 print_file_data(string_get_cstr(parsedpath), fileinfo, true, is_lflag, -1, -1, -1, -1, -1);
             free(fileinfo);
         }
-        argtable_delete(argtab);
         string_delete(parsedpath);
         return;
     }
@@ -213,101 +300,133 @@ void cmd_reveal(ShellData sd, Process p) {
     }
     else if (is_lflag)
         printf("total 0\n");
-    argtable_delete(argtab);
     string_delete(parsedpath);
     free(namelist);
 }
 
 void cmd_log(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("command,index"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&log_args, p->argv, &argtab) < 0)
         return;
+    log_open(sd);
     
-    bool_t purge = false, execute = false;
+    bool_t purge = false, execute = false, search = false, stats = false;
     int index = 0;
-    String command = argtable_get_pos_arg(argtab, "command");
+    char* command = argtable_get_pos_arg(&argtab, 0);
+    char* extra = argtable_get_pos_arg(&argtab, 1);
     if (command)
     {
-        if (string_is_equalc(command, "purge"))
+        if (strcmp(command, "purge") == 0)
             purge = true;
-        else if (string_is_equalc(command, "execute"))
+        else if (strcmp(command, "execute") == 0)
             execute = true;
+        else if (strcmp(command, "search") == 0)
+            search = true;
+        else if (strcmp(command, "stats") == 0)
+            stats = true;
         else
         {
-            fprintf(stderr, "log: Unknown argument %s.\n", string_get_cstr(command));
-            argtable_delete(argtab);
+            fprintf(stderr, "log: Unknown argument %s.\n", command);
             return;
         }
-        String indexstr = argtable_get_pos_arg(argtab, "index");
-        if (indexstr)
+        if (extra)
         {
-            if (purge || !execute)
+            if (purge || stats)
             {
-                fprintf(stderr, "log: Unexpected argument %s.\n", string_get_cstr(indexstr));
-                argtable_delete(argtab);
+                fprintf(stderr, "log: Unexpected argument %s.\n", extra);
                 return;
             }
-            if (str2int(&index, string_get_cstr(indexstr), 10) != STR2INT_SUCCESS || index < 1 || index > 15)
+            if (execute && (str2int(&index, extra, 10) != STR2INT_SUCCESS || index < 1))
             {
-                fprintf(stderr, "log: index must be a positive integer between 1 and 15.\n");
-                argtable_delete(argtab);
+                fprintf(stderr, "log: index must be a positive integer.\n");
                 return;
             }
         }
         else if (execute)
         {
             fprintf(stderr, "log: Expected argument \"index\" after execute.\n");
-            argtable_delete(argtab);
             return;
         } 
+        else if (search)
+        {
+            fprintf(stderr, "log: Expected argument \"text\" after search.\n");
+            return;
+        }
     }
 
     if (purge)
     {
         log_purge(sd);
-        argtable_delete(argtab);
         return;
     }
-    Vector logcmds = log_read(sd);
+    if (stats)
+    {
+        log_stats(sd);
+        return;
+    }
+
+    size_t count = history_count(sd->history);
+    size_t len;
+    char* entry;
 
     if (execute)
     {
-        if (index > logcmds->len)
+        if (index > count || !(entry = history_get(sd->history, index, &len)))
         {
-            fprintf(stderr, "log: index (%d) greater than current log size (%ld).\n", index, logcmds->len);
-            vector_free_str(logcmds);
-            vector_delete(logcmds);
-            argtable_delete(argtab);
+            fprintf(stderr, "log: index (%d) greater than current log size (%ld).\n", index, count);
+            return;
         }
 
-        JobList jl = parse_input(sd, logcmds->data[logcmds->len-index]);
+        // Copied out, since logging the command may move the mapping.
+        st_StringBuilder sb;
+        strbuilder_init(&sb, len+1);
+        strbuilder_append_cstrn(&sb, entry, len);
+        String cmd = strbuilder_finish(&sb);
+        JobList jl = parse_input(sd, cmd);
         run_jobs(sd, jl);
-        vector_free_str(logcmds);
-        vector_delete(logcmds);
-        argtable_delete(argtab);
+        string_delete(cmd);
+        return;
+    }
+
+    if (search)
+    {
+        uint64_t results[HISTORY_SEARCH_MAX];
+        size_t found = history_search(sd->history, extra, strlen(extra), results, HISTORY_SEARCH_MAX);
+        for (size_t i = 0; i < found; i++)
+        {
+            entry = history_text(sd->history, results[i], &len);
+            printf("%.*s\n", (int)len, entry);
+        }
         return;
     }
 
-    for (int i = 0; i < logcmds->len; i++)
-        printf("%s", string_get_cstr(logcmds->data[i]));
-    vector_free_str(logcmds);
-    vector_delete(logcmds);
-    argtable_delete(argtab);
+    uint64_t shown[HISTORY_LOG_SHOWN];
+    size_t nshown = 0;
+    if (sd->history)
+    {
+        uint64_t off = history_prev(sd->history, history_end(sd->history));
+        for (; off != 0 && nshown < HISTORY_LOG_SHOWN; off = history_older(sd->history, off))
+            shown[nshown++] = off;
+    }
+    for (size_t i = nshown; i > 0; i--)
+    {
+        entry = history_text(sd->history, shown[i-1], &len);
+        printf("%.*s\n", (int)len, entry);
+    }
 }
 
 void cmd_proclore(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("pid"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&proclore_args, p->argv, &argtab) < 0)
         return;
     
     pid_t pid = -1;
-    String pidstr = argtable_get_pos_arg(argtab, "pid");
+    char* pidstr = argtable_get_pos_arg(&argtab, 0);
     if (pidstr)
     {
-        if (str2int(&pid, string_get_cstr(pidstr), 10) != STR2INT_SUCCESS || pid < 0)
+        if (str2int(&pid, pidstr, 10) != STR2INT_SUCCESS || pid < 0)
         {
             fprintf(stderr, "proclore: pid must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
@@ -364,35 +483,32 @@ void cmd_proclore(ShellData sd, Process p) {
     printf("executable path : %s\n", string_get_cstr(exec_path));
 
     string_delete(exec_path);
-    argtable_delete(argtab);
 }
 
 void cmd_seek(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("-d,-f,-e,target,searchdir"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&seek_args, p->argv, &argtab) < 0)
         return;
     
-    String target = argtable_get_pos_arg(argtab, "target");
+    char* target = argtable_get_pos_arg(&argtab, 0);
     if (!target)
     {
         fprintf(stderr, "seek: Expected argument \"target\".\n");
-        argtable_delete(argtab);
         return;
     }
-    String searchdir = argtable_get_pos_arg(argtab, "searchdir");
+    char* searchdir = argtable_get_pos_arg(&argtab, 1);
     String parsed_path;
     if (!searchdir)
         parsed_path = string_create_copyc(".");
     else
-        parsed_path = parse_path(sd, string_get_cstr(searchdir));
-    bool_t is_dflag = argtable_is_flag_set(argtab, 'd');
-    bool_t is_eflag = argtable_is_flag_set(argtab, 'e');
-    bool_t is_fflag = argtable_is_flag_set(argtab, 'f');
+        parsed_path = parse_path(sd, searchdir);
+    bool_t is_dflag = argtable_is_flag_set(&argtab, 'd');
+    bool_t is_eflag = argtable_is_flag_set(&argtab, 'e');
+    bool_t is_fflag = argtable_is_flag_set(&argtab, 'f');
     if (is_dflag && is_fflag)
     {
         fprintf(stderr, "seek: Options \"-f\" and \"-d\" cannot be set at the same time.\n");
         string_delete(parsed_path);
-        argtable_delete(argtab);
         return;
     }
 
@@ -420,7 +536,10 @@ void cmd_seek(ShellData sd, Process p) {
                     fprintf(stderr, "Missing permissions for task!\n");
             }
             else
+            {
                 string_set_equal(sd->prev_path, prevpath);
+                prompt_invalidate(sd);
+            }
             string_delete(prevpath);
         }
         else
@@ -440,7 +559,6 @@ void cmd_seek(ShellData sd, Process p) {
     }
 
     find_clean();
-    argtable_delete(argtab);
     string_delete(parsed_path);
 }
 
@@ -452,26 +570,49 @@ int strsort_cmp(const void * a, const void * b ) {
 }
 
 void cmd_activities(ShellData sd, Process p) {
+    st_ArgTable argtab;
+    if (parse_args(&activities_args, p->argv, &argtab) < 0)
+        return;
+    bool_t is_vflag = argtable_is_flag_set(&argtab, 'v');
+
     if (!sd->jobs || sd->jobs->size == 0)
         return;
     Vector job_update_strings = vector_create(0);
-    for (JobListNode node = sd->jobs->sentinel->next; node != sd->jobs->sentinel; )
+    for (size_t i = 0; i < sd->jobs->nslots; i++)
     {
-        JobListNode next = NULL;
-
-        if (job_is_done(node->job))
+        Job j = sd->jobs->slots[i];
+        if (!j || job_is_done(j))
             continue;
-        ssize_t bufsz = snprintf(NULL, 0, "%d : %s - Stopped\n", node->job->pgid, string_get_cstr(node->job->command));
-        char* buf = malloc(bufsz + 1);
-        if (job_is_stopped(node->job))
-            snprintf(buf, bufsz + 1, "%d : %s - Stopped\n", node->job->pgid, string_get_cstr(node->job->command));
-        else
-            snprintf(buf, bufsz + 1, "%d : %s - Running\n", node->job->pgid, string_get_cstr(node->job->command));
-        vector_append(job_update_strings, buf);
-
-        if (!next)
-            next = node->next;
-        node = next;
+        st_StringBuilder sb;
+        strbuilder_init(&sb, string_get_strlen(j->command) + 32);
+        strbuilder_append_fmt(&sb, "%d : %s - %s", j->pgid, string_get_cstr(j->command),
+                              job_is_stopped(j) ? "Stopped" : "Running");
+        cpu_set_t cpus;
+        if (job_get_affinity(j, &cpus))
+        {
+            strbuilder_append_cstr(&sb, " [cpus ");
+            cpuset_append(&sb, &cpus);
+            strbuilder_append_cstrn(&sb, "]", 1);
+        }
+        st_SchedPrio prio;
+        if (job_get_prio(j, &prio))
+        {
+            strbuilder_append_cstr(&sb, " [");
+            schedprio_append(&sb, &prio);
+            strbuilder_append_cstrn(&sb, "]", 1);
+        }
+        strbuilder_append_cstrn(&sb, "\n", 1);
+        if (is_vflag)
+        {
+            st_ResUsage usage;
+            job_get_usage(j, &usage);
+            strbuilder_append_cstr(&sb, "    ");
+            resusage_append(&sb, &usage, true);
+            strbuilder_append_cstrn(&sb, "\n", 1);
+        }
+        String line = strbuilder_finish(&sb);
+        vector_append(job_update_strings, strdup(string_get_cstr(line)));
+        string_delete(line);
     }
 
     if (job_update_strings->len == 0)
@@ -491,50 +632,45 @@ void cmd_activities(ShellData sd, Process p) {
 }
 
 void cmd_ping(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("pid,signal_number"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&ping_args, p->argv, &argtab) < 0)
         return;
     
     pid_t pid = -1;
-    String pidstr = argtable_get_pos_arg(argtab, "pid");
+    char* pidstr = argtable_get_pos_arg(&argtab, 0);
     if (pidstr)
     {
-        if (str2int(&pid, string_get_cstr(pidstr), 10) != STR2INT_SUCCESS || pid < 0)
+        if (str2int(&pid, pidstr, 10) != STR2INT_SUCCESS || pid < 0)
         {
             fprintf(stderr, "ping: pid must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
     else
     {
         fprintf(stderr, "ping: Expected argument \"pid\".\n");
-        argtable_delete(argtab);
         return;
     }
 
     int sigid = -1;
-    String sigstr = argtable_get_pos_arg(argtab, "signal_number");
+    char* sigstr = argtable_get_pos_arg(&argtab, 1);
     if (sigstr)
     {
-        if (str2int(&sigid, string_get_cstr(sigstr), 10) != STR2INT_SUCCESS || sigid < 0)
+        if (str2int(&sigid, sigstr, 10) != STR2INT_SUCCESS || sigid < 0)
         {
             fprintf(stderr, "ping: signal_number must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
     else
     {
         fprintf(stderr, "ping: Expected argument \"signal_number\".\n");
-        argtable_delete(argtab);
         return;
     }
 
     if (sigid%32 == 0)
     {
         fprintf(stderr, "ping: 0 (%d%%32) is an invalid signal_number.\n", sigid);
-        argtable_delete(argtab);
         return;
     }
 
@@ -543,85 +679,76 @@ void cmd_ping(ShellData sd, Process p) {
 
     if (ret == 0)
         printf("Sent signal %d to process with pid %d\n", sigid, pid);
-    argtable_delete(argtab);
 }
 
 void cmd_fg(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("pid"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&fgbg_args, p->argv, &argtab) < 0)
         return;
     
     pid_t pid = -1;
-    String pidstr = argtable_get_pos_arg(argtab, "pid");
+    char* pidstr = argtable_get_pos_arg(&argtab, 0);
     if (pidstr)
     {
-        if (str2int(&pid, string_get_cstr(pidstr), 10) != STR2INT_SUCCESS || pid < 0)
+        if (str2int(&pid, pidstr, 10) != STR2INT_SUCCESS || pid < 0)
         {
             fprintf(stderr, "fg: pid must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
     else
     {
         fprintf(stderr, "fg: Expected argument \"pid\".");
-        argtable_delete(argtab);
         return;
     }
 
     if (!job_continue(sd, pid, true))
         fprintf(stderr, "fg: No such process found.\n");
-    argtable_delete(argtab);
 }
 
 void cmd_bg(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("pid"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&fgbg_args, p->argv, &argtab) < 0)
         return;
     
     pid_t pid = -1;
-    String pidstr = argtable_get_pos_arg(argtab, "pid");
+    char* pidstr = argtable_get_pos_arg(&argtab, 0);
     if (pidstr)
     {
-        if (str2int(&pid, string_get_cstr(pidstr), 10) != STR2INT_SUCCESS || pid < 0)
+        if (str2int(&pid, pidstr, 10) != STR2INT_SUCCESS || pid < 0)
         {
             fprintf(stderr, "bg: pid must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
     else
     {
         fprintf(stderr, "bg: Expected argument \"pid\".");
-        argtable_delete(argtab);
         return;
     }
 
     if (!job_continue(sd, pid, false))
         fprintf(stderr, "bg: No such process found.\n");
-    argtable_delete(argtab);
 }
 
 void cmd_neonate(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("+n"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&neonate_args, p->argv, &argtab) < 0)
         return;
     
     int timeinterval = 0;
-    String timestr = argtable_get_add_arg(argtab, 'n');
+    char* timestr = argtable_get_add_arg(&argtab, 'n');
     if (timestr)
     {
-        if (str2int(&timeinterval, string_get_cstr(timestr), 10) != STR2INT_SUCCESS || timeinterval < 0)
+        if (str2int(&timeinterval, timestr, 10) != STR2INT_SUCCESS || timeinterval < 0)
         {
             fprintf(stderr, "neonate: time_arg must be a positive integer.\n");
-            argtable_delete(argtab);
             return;
         }
     }
     else
     {
         fprintf(stderr, "neonate: Expected flag \"-n\"\n");
-        argtable_delete(argtab);
         return;
     }
 
@@ -663,19 +790,17 @@ void cmd_neonate(ShellData sd, Process p) {
             printfirst = false;
     }
 
-    argtable_delete(argtab);
 }
 
 void cmd_iMan(ShellData sd, Process p) {
-    ArgTable argtab = parse_args(string_create_copyc("cmd,idiot,fool"), p->argv);
-    if (!argtab)
+    st_ArgTable argtab;
+    if (parse_args(&iman_args, p->argv, &argtab) < 0)
         return;
 
-    String searchstr = argtable_get_pos_arg(argtab, "cmd");
+    char* searchstr = argtable_get_pos_arg(&argtab, 0);
     if (!searchstr)
     {
         fprintf(stderr, "iMan: Expected argument \"cmd_name\".\n");
-        argtable_delete(argtab);
         return;
     }
 
@@ -689,7 +814,6 @@ void cmd_iMan(ShellData sd, Process p) {
     if (getaddrinfo("man.he.net", "http", &dns_hints, &dns) < 0)
     {
         warn_failure(-1, "%s", "getaddrinfo");
-        argtable_delete(argtab);
         return;
     }
 
@@ -706,16 +830,14 @@ void cmd_iMan(ShellData sd, Process p) {
     if (sock == -1)
     {
         fprintf(stderr, "iMan: Unable to connect to man.he.net.\n");
-        argtable_delete(argtab);
         return;
     }
     
-    char* getreqstr = malloc(60+string_get_strlen(searchstr));
-    sprintf(getreqstr, "GET /?topic=%s&section=all HTTP/1.1\r\nHost: man.he.net\r\n\r\n", string_get_cstr(searchstr));
+    char* getreqstr = malloc(60+strlen(searchstr));
+    sprintf(getreqstr, "GET /?topic=%s&section=all HTTP/1.1\r\nHost: man.he.net\r\n\r\n", searchstr);
     if (write(sock, getreqstr, strlen(getreqstr)) < 0)
     {
         warn_failure(-1, "%s", "write");
-        argtable_delete(argtab);
         free(getreqstr);
         return;
     }
@@ -744,9 +866,323 @@ void cmd_iMan(ShellData sd, Process p) {
         printf("%s", &buf[start]);
     }
     if (invalid)
-        fprintf(stderr, "iMan: No matches for command \"%s\"\n", string_get_cstr(searchstr));        
+        fprintf(stderr, "iMan: No matches for command \"%s\"\n", searchstr);        
     fflush(stdout);
     free(buf);
     close(sock);
-    argtable_delete(argtab);
-}
\ No newline at end of file
+}
+
+void cmd_hash(ShellData sd, Process p) {
+    st_ArgTable argtab;
+    if (parse_args(&hash_args, p->argv, &argtab) < 0)
+        return;
+
+    if (argtable_is_flag_set(&argtab, 'r'))
+        cmdhash_clear(sd->cmds);
+
+    if (argtab.num_posit == 0)
+    {
+        if (!argtable_is_flag_set(&argtab, 'r'))
+            cmdhash_print(sd->cmds);
+        return;
+    }
+
+    cmdhash_expire(sd->cmds);
+    for (size_t i = 0; i < argtab.num_posit; i++)
+    {
+        char* name = argtable_get_pos_arg(&argtab, i);
+        if (!cmdhash_rehash(sd->cmds, name))
+            fprintf(stderr, "hash: %s: not found\n", name);
+    }
+}
+
+// parallel [-j N] [-g] command... [::: argument...]
+// Options come first and the template runs up to :::. Without :::, the
+// arguments are the lines of stdin. The argument list is unbounded, so
+// this is parsed by hand rather than with an ArgSpec.
+void cmd_parallel(ShellData sd, Process p) {
+    char** argv = (char**)p->argv->data;
+    size_t argc = p->argc;
+
+    st_Parallel par;
+    par.maxjobs = parallel_default_jobs();
+    par.group = false;
+    size_t i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    {
+        if (strcmp(argv[i], "-g") == 0)
+            par.group = true;
+        else if (strncmp(argv[i], "-j", 2) == 0)
+        {
+            char* num = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            int n;
+            if (!num || str2int(&n, num, 10) != STR2INT_SUCCESS || n < 1 || n > PARALLEL_MAX_JOBS)
+            {
+                fprintf(stderr, "parallel: -j must be an integer from 1 to %d.\n", PARALLEL_MAX_JOBS);
+                return;
+            }
+            par.maxjobs = n;
+        }
+        else
+        {
+            fprintf(stderr, "parallel: Invalid flag %s.\n", argv[i]);
+            return;
+        }
+    }
+
+    size_t sep = i;
+    while (sep < argc && strcmp(argv[sep], PARALLEL_SEPARATOR) != 0)
+        sep++;
+    if (sep == i)
+    {
+        fprintf(stderr, "parallel: Expected a command.\n");
+        return;
+    }
+    par.tmpl = argv + i;
+    par.ntmpl = sep - i;
+    par.args = vector_create(0);
+    par.null_stdin = (sep == argc);
+
+    if (sep < argc)
+        for (size_t k = sep + 1; k < argc; k++)
+            vector_append(par.args, strdup(argv[k]));
+    else if (isatty(STDIN_FILENO))
+    {
+        fprintf(stderr, "parallel: Expected arguments after %s or on stdin.\n", PARALLEL_SEPARATOR);
+        vector_delete(par.args);
+        return;
+    }
+    else
+    {
+        LineReader lr = linereader_create(STDIN_FILENO, LINEREADER_BUFLEN);
+        char* line;
+        size_t len;
+        while (linereader_next(lr, &line, &len) == 0)
+            if (len > 0)
+                vector_append(par.args, strndup(line, len));
+        linereader_delete(lr);
+    }
+
+    parallel_run(sd, &par);
+
+    vector_free_cstr(par.args);
+    vector_delete(par.args);
+}
+
+// Joins argv[start..stop) back into a command line for parse_input.
+static String bench_join(char** argv, size_t start, size_t stop) {
+    st_StringBuilder sb;
+    strbuilder_init(&sb, 64);
+    for (size_t i = start; i < stop; i++)
+    {
+        if (i > start)
+            strbuilder_append_cstrn(&sb, " ", 1);
+        strbuilder_append_cstr(&sb, argv[i]);
+    }
+    return strbuilder_finish(&sb);
+}
+
+void cmd_bench(ShellData sd, Process p) {
+    char** argv = (char**)p->argv->data;
+    size_t argc = p->argc;
+
+    st_Bench b;
+    b.runs = BENCH_DEFAULT_RUNS;
+    b.warmups = BENCH_DEFAULT_WARMUPS;
+    size_t i = 1;
+    for (; i < argc && argv[i][0] == '-' && (argv[i][1] == 'n' || argv[i][1] == 'w'); i++)
+    {
+        char flag = argv[i][1];
+        char* num = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : NULL);
+        int n;
+        if (!num || str2int(&n, num, 10) != STR2INT_SUCCESS || n < (flag == 'n') || n > BENCH_MAX_RUNS)
+        {
+            fprintf(stderr, "bench: -%c must be an integer from %d to %d.\n", flag, flag == 'n', BENCH_MAX_RUNS);
+            return;
+        }
+        if (flag == 'n')
+            b.runs = n;
+        else
+            b.warmups = n;
+    }
+
+    size_t sep = i;
+    while (sep < argc && strcmp(argv[sep], BENCH_SEPARATOR) != 0)
+        sep++;
+    if (sep == i || (sep < argc && sep + 1 == argc))
+    {
+        fprintf(stderr, "bench: Expected a command.\n");
+        return;
+    }
+
+    // A background bench runs in a forked child, whose runs must not try
+    // to take the terminal from the shell.
+    if (p->job && p->job->is_bg)
+        sd->interactive = false;
+
+    b.ncmds = (sep < argc) ? 2 : 1;
+    b.cmds[0] = bench_join(argv, i, sep);
+    if (b.ncmds == 2)
+        b.cmds[1] = bench_join(argv, sep + 1, argc);
+    for (size_t c = 0; c < b.ncmds; c++)
+        b.results[c] = calloc(b.runs, sizeof(st_BenchRun));
+
+    if (bench_run(sd, &b))
+        bench_report(&b);
+
+    for (size_t c = 0; c < b.ncmds; c++)
+    {
+        free(b.results[c]);
+        string_delete(b.cmds[c]);
+    }
+}
+
+/*
+pin -d CPUS sets the CPUs background jobs are pinned to unless they carry
+their own "pin CPUS" prefix, and pin -d none drops the default. pin -p PGID
+CPUS moves a running job, and pin -p PGID shows where it may run. Bare pin
+shows the default.
+*/
+void cmd_pin(ShellData sd, Process p) {
+    st_ArgTable argtab;
+    if (parse_args(&pin_args, p->argv, &argtab) < 0)
+        return;
+
+    char* defcpus = argtable_get_add_arg(&argtab, 'd');
+    char* pgidstr = argtable_get_add_arg(&argtab, 'p');
+    char* cpustr = argtable_get_pos_arg(&argtab, 0);
+    cpu_set_t cpus;
+    st_StringBuilder sb;
+    if (defcpus)
+    {
+        if (strcmp(defcpus, "none") == 0)
+            sd->bg_pinned = false;
+        else if (cpuset_parse(defcpus, &cpus))
+        {
+            sd->bg_pinned = true;
+            sd->bg_cpus = cpus;
+        }
+        else
+            fprintf(stderr, "pin: Invalid CPU list %s.\n", defcpus);
+        return;
+    }
+    if (!pgidstr)
+    {
+        if (!sd->bg_pinned)
+        {
+            printf("background jobs: not pinned\n");
+            return;
+        }
+        strbuilder_init(&sb, 32);
+        cpuset_append(&sb, &sd->bg_cpus);
+        String list = strbuilder_finish(&sb);
+        printf("background jobs: cpus %s\n", string_get_cstr(list));
+        string_delete(list);
+        return;
+    }
+
+    pid_t pgid;
+    Job j;
+    if (str2int(&pgid, pgidstr, 10) != STR2INT_SUCCESS || pgid <= 0 || !(j = joblist_find_job(sd->jobs, pgid)))
+    {
+        fprintf(stderr, "pin: No such job %s.\n", pgidstr);
+        return;
+    }
+    if (!cpustr)
+    {
+        if (!job_get_affinity(j, &cpus))
+        {
+            fprintf(stderr, "pin: Job %d has no running process.\n", pgid);
+            return;
+        }
+        strbuilder_init(&sb, 32);
+        cpuset_append(&sb, &cpus);
+        String list = strbuilder_finish(&sb);
+        printf("%d : cpus %s\n", pgid, string_get_cstr(list));
+        string_delete(list);
+        return;
+    }
+    if (!cpuset_parse(cpustr, &cpus))
+    {
+        fprintf(stderr, "pin: Invalid CPU list %s.\n", cpustr);
+        return;
+    }
+    int moved = pgrp_set_affinity(pgid, &cpus);
+    if (moved < 0)
+        warn_failure(-1, "%s", "pin");
+    else if (moved == 0)
+        fprintf(stderr, "pin: Could not move any thread of job %d.\n", pgid);
+    else
+    {
+        j->is_pinned = true;
+        j->cpus = cpus;
+    }
+}
+
+/*
+prio -d on|off turns the demotion of background jobs on or off for the
+shell, and prio -n N also makes them N nicer, which cannot be undone on fg
+without privileges. prio -p PGID
+batch|normal|default overrides it for one job, taking effect at once, the
+same way a "prio batch" or "prio normal" prefix does at launch. Bare prio
+shows the settings.
+*/
+void cmd_prio(ShellData sd, Process p) {
+    st_ArgTable argtab;
+    if (parse_args(&prio_args, p->argv, &argtab) < 0)
+        return;
+
+    char* demote = argtable_get_add_arg(&argtab, 'd');
+    char* nicestr = argtable_get_add_arg(&argtab, 'n');
+    char* pgidstr = argtable_get_add_arg(&argtab, 'p');
+    char* policy = argtable_get_pos_arg(&argtab, 0);
+    if (demote)
+    {
+        if (strcmp(demote, "on") == 0 || strcmp(demote, "off") == 0)
+            sd->bg_demote = (demote[1] == 'n');
+        else
+            fprintf(stderr, "prio: -d takes on or off.\n");
+    }
+    if (nicestr)
+    {
+        int nice;
+        if (str2int(&nice, nicestr, 10) != STR2INT_SUCCESS || nice < 0 || nice > 19)
+            fprintf(stderr, "prio: -n must be an integer from 0 to 19.\n");
+        else
+            sd->bg_nice = nice;
+    }
+    if (!pgidstr)
+    {
+        if (!demote && !nicestr)
+            printf("background jobs: %s, nice +%d\n", sd->bg_demote ? "batch" : "normal", sd->bg_nice);
+        return;
+    }
+
+    pid_t pgid;
+    Job j;
+    if (str2int(&pgid, pgidstr, 10) != STR2INT_SUCCESS || pgid <= 0 || !(j = joblist_find_job(sd->jobs, pgid)))
+    {
+        fprintf(stderr, "prio: No such job %s.\n", pgidstr);
+        return;
+    }
+    if (!policy)
+    {
+        fprintf(stderr, "prio: Expected batch, normal or default.\n");
+        return;
+    }
+    if (strcmp(policy, "batch") == 0)
+        j->prio = JOB_PRIO_BATCH;
+    else if (strcmp(policy, "normal") == 0)
+        j->prio = JOB_PRIO_NORMAL;
+    else if (strcmp(policy, "default") == 0)
+        j->prio = JOB_PRIO_DEFAULT;
+    else
+    {
+        fprintf(stderr, "prio: Expected batch, normal or default.\n");
+        return;
+    }
+    // Jobs in the list are never in the foreground, so apply the new
+    // choice right away.
+    job_restore_prio(j);
+    job_demote(sd, j, true);
+}
@@ -15,13 +15,17 @@
 #include <fcntl.h>
 #include <ftw.h>
 #include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "mystring.h"
 #include "vector.h"
+#include "history.h"
 #include "vecutils.h"
 #include "shelldata.h"
 #include "jobctrl.h"
 #include "shellcmdutils.h"
+#include "prompt.h"
 
 char* get_username_uid(uid_t uid) {
     struct passwd* pw = getpwuid(uid);
@@ -38,26 +42,20 @@ char* get_grpname_gid(gid_t gid) {
 }
 
 String parse_path(ShellData sd, char* path) {
-    String pathstr = string_create(path, 0);
-    String parsed_path = NULL;
-    if (string_cmp_idx(pathstr, 0, '~'))
+    if (path[0] == '~' && path[1] == 0)
+        return string_create_copy(sd->home_dir_path);
+    if (path[0] == '~' && path[1] == '/')
     {
-        if (string_get_strlen(pathstr) == 1)
-            parsed_path = string_create_copy(sd->home_dir_path);
-        if (string_cmp_idx(pathstr, 1, '/'))
-        {
-            string_set_offset(pathstr, 1);
-            parsed_path = string_add(sd->home_dir_path, pathstr);
-        }
+        st_StringBuilder sb;
+        size_t pathlen = strlen(path+1);
+        strbuilder_init(&sb, string_get_strlen(sd->home_dir_path) + pathlen + 1);
+        strbuilder_append(&sb, sd->home_dir_path);
+        strbuilder_append_cstrn(&sb, path+1, pathlen);
+        return strbuilder_finish(&sb);
     }
-    else if (string_cmp_idx(pathstr, 0, '-') && (string_get_strlen(pathstr) == 1))
-        parsed_path = string_create_copy(sd->prev_path);
-    
-    if (!parsed_path)
-        parsed_path = string_create_copy(pathstr);
-    
-    free(pathstr);
-    return parsed_path;
+    if (path[0] == '-' && path[1] == 0)
+        return string_create_copy(sd->prev_path);
+    return string_create_copyc(path);
 }
 
 void print_file_data(char* name, struct stat* info, bool_t print_hidden, bool_t print_extra, int pad_nlink, int pad_size, int pad_uname, int pad_gname, int pad_time) {
@@ -171,66 +169,243 @@ str2int_errno str2int(int *out, char *s, int base) {
     return STR2INT_SUCCESS;
 }
 
+String log_get_path(ShellData sd) {
+    st_StringBuilder sb;
+    strbuilder_init(&sb, string_get_strlen(sd->home_dir_path) + sizeof(LOG_FILE_NAME));
+    strbuilder_append(&sb, sd->home_dir_path);
+    strbuilder_append_cstrn(&sb, LOG_FILE_NAME, sizeof(LOG_FILE_NAME)-1);
+    return strbuilder_finish(&sb);
+}
+
+// Opening takes the history lock and catches up the search index, so
+// batch shells put it off until a log builtin actually needs it.
+void log_open(ShellData sd) {
+    if (sd->history)
+        return;
+    String log_path = log_get_path(sd);
+    sd->history = history_open(string_get_cstr(log_path));
+    string_delete(log_path);
+}
+
 void log_purge(ShellData sd) {
-    String logfile = string_create_copyc("/.yash_log");
-    String logfile_path = string_add(sd->home_dir_path, logfile);
-    fclose(fopen(string_get_cstr(logfile_path), "w"));
-    string_delete(logfile);
-    string_delete(logfile_path);
+    history_clear(sd->history);
 }
 
-Vector log_read(ShellData sd) {
-    String logfile = string_create_copyc("/.yash_log");
-    String logfile_path = string_add(sd->home_dir_path, logfile);
-    Vector logcmds = vector_create(0);
-    FILE* logfilef = fopen(string_get_cstr(logfile_path), "a+");
+static uint64_t timespec_us(struct timespec ts) {
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    char* templinebuf = NULL;
-    size_t sz = 0;
-    ssize_t len = 0;
-    while ((len = getline(&templinebuf, &sz, logfilef)) > 0)
-    {
-        vector_append(logcmds, string_create_copyc(templinebuf));
-        // printf("[%s]\n", templinebuf);
-    }
-    free(templinebuf);
-    fclose(logfilef);
-    string_delete(logfile);
-    string_delete(logfile_path);
+static uint64_t timeval_us(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// CPU time of the shell plus every child it has reaped so far.
+static void log_cpu_time(uint64_t* user, uint64_t* sys) {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    *user = timeval_us(self.ru_utime) + timeval_us(children.ru_utime);
+    *sys = timeval_us(self.ru_stime) + timeval_us(children.ru_stime);
+}
+
+// Takes the readings log_update measures a line against, and returns the
+// cwd the line starts in (a builtin may change it while the line runs).
+String log_start(ShellData sd, JobList jl, st_HistoryRecord* meta) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    meta->start = timespec_us(now);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    meta->wall = timespec_us(now);
+    log_cpu_time(&meta->user, &meta->sys);
+
+    String cwd = prompt_get_cwd(sd);
+    return string_create_arena(jl->arena, string_get_cstr(cwd), string_get_strlen(cwd));
+}
+
+// Records the line of jl with the time and CPU it took since log_start and
+// the exit code of its last process (-1 if that is still running).
+void log_update(ShellData sd, JobList jl, st_HistoryRecord* meta, String cwd) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    meta->wall = timespec_us(now) - meta->wall;
+    uint64_t user, sys;
+    log_cpu_time(&user, &sys);
+    meta->user = user - meta->user;
+    meta->sys = sys - meta->sys;
+
+    Job last = joblist_last(jl);
+    Process lastproc = last->procs->data[last->procs->len-1];
+    if (!lastproc->is_done)
+        meta->status = -1;
+    else
+        meta->status = process_exit_code(lastproc);
+
+    history_append(sd->history, meta, string_get_cstr(jl->line), string_get_strlen(jl->line),
+                   string_get_cstr(cwd), string_get_strlen(cwd));
+}
+
+#define LOG_STATS_BUCKETS 256
+#define LOG_STATS_TOP 10
+
+typedef struct st_LogStat
+{
+    const char* name;
+    size_t namelen, count;
+    uint64_t total;
+    uint32_t hist[LOG_STATS_BUCKETS];
+} st_LogStat;
+
+typedef st_LogStat* LogStat;
+
+// Log-scale histogram with four buckets per power of two (within 25%).
+static size_t log_stats_bucket(uint64_t us) {
+    if (us < 4)
+        return us;
+    int b = 63 - __builtin_clzll(us);
+    return (b-1)*4 + ((us >> (b-2)) & 3);
+}
+
+// Midpoint of bucket k.
+static uint64_t log_stats_bucket_value(size_t k) {
+    if (k < 4)
+        return k;
+    size_t shift = k/4 - 1;
+    return ((uint64_t)(4 + k%4) << shift) + ((1UL << shift) >> 1);
+}
 
-    return logcmds;
+static uint64_t log_stats_percentile(LogStat st, double p) {
+    size_t rank = (size_t)(p * st->count + 0.999999), seen = 0;
+    for (size_t k = 0; k < LOG_STATS_BUCKETS; k++)
+        if ((seen += st->hist[k]) >= rank && seen > 0)
+            return log_stats_bucket_value(k);
+    return 0;
 }
 
-void log_update(ShellData sd, String cmd, JobList jl) {
-    if (joblist_check_cmd(jl, "log"))
+static void log_format_us(char* buf, size_t n, uint64_t us) {
+    if (us < 1000)
+        snprintf(buf, n, "%luus", us);
+    else if (us < 1000000)
+        snprintf(buf, n, "%.1fms", us / 1e3);
+    else
+        snprintf(buf, n, "%.2fs", us / 1e6);
+}
+
+static int log_stats_cmp(const void* a, const void* b) {
+    const st_LogStat* x = *(const st_LogStat**)a;
+    const st_LogStat* y = *(const st_LogStat**)b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static size_t log_stats_hash(const char* s, size_t n) {
+    size_t h = 14695981039346656037UL;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211UL;
+    return h;
+}
+
+// Streams over the history once. Per command name it keeps only a count and
+// a fixed-size latency histogram, so memory grows with the number of
+// distinct names rather than with the length of the history.
+void log_stats(ShellData sd) {
+    History h = sd->history;
+    if (!h)
         return;
-    
-    String cmdnewl = string_addc(cmd, "\n");
 
-    Vector logcmds = log_read(sd);
-    if (logcmds->len > 0 && string_is_equal(logcmds->data[logcmds->len-1], cmdnewl))
+    size_t cap = 256, used = 0;
+    LogStat table = calloc(cap, sizeof(st_LogStat));
+    uint64_t slowest[LOG_STATS_TOP];
+    size_t nslow = 0;
+
+    uint64_t end = history_end(h);
+    for (uint64_t off = history_begin(h); off < end; off += history_record(h, off)->size)
+    {
+        HistoryRecord rec = history_record(h, off);
+        if (rec->size == 0 || off + rec->size > end)
+            break;
+
+        size_t i = 0, n;
+        while (i < rec->len && isspace((unsigned char)rec->text[i]))
+            i++;
+        for (n = 0; i+n < rec->len && !strchr(" \t|;&<>", rec->text[i+n]); n++)
+            ;
+        if (n == 0)
+            continue;
+
+        if ((used+1)*10 > cap*7)
+        {
+            LogStat old = table;
+            size_t oldcap = cap;
+            cap *= 2;
+            table = calloc(cap, sizeof(st_LogStat));
+            for (size_t k = 0; k < oldcap; k++)
+                if (old[k].name)
+                {
+                    size_t slot = log_stats_hash(old[k].name, old[k].namelen) & (cap-1);
+                    while (table[slot].name)
+                        slot = (slot+1) & (cap-1);
+                    table[slot] = old[k];
+                }
+            free(old);
+        }
+
+        size_t slot = log_stats_hash(rec->text+i, n) & (cap-1);
+        while (table[slot].name && (table[slot].namelen != n || memcmp(table[slot].name, rec->text+i, n) != 0))
+            slot = (slot+1) & (cap-1);
+        LogStat st = &table[slot];
+        if (!st->name)
+        {
+            st->name = rec->text+i;
+            st->namelen = n;
+            used++;
+        }
+        st->count++;
+        st->total += rec->wall;
+        st->hist[log_stats_bucket(rec->wall)]++;
+
+        // Keep the slowest few, sorted slowest first.
+        size_t pos = nslow;
+        while (pos > 0 && history_record(h, slowest[pos-1])->wall < rec->wall)
+            pos--;
+        if (pos < LOG_STATS_TOP)
+        {
+            if (nslow < LOG_STATS_TOP)
+                nslow++;
+            memmove(&slowest[pos+1], &slowest[pos], sizeof(uint64_t) * (nslow-pos-1));
+            slowest[pos] = off;
+        }
+    }
+
+    char wall[32], user[32], sys[32];
+    printf("Slowest commands:\n");
+    for (size_t i = 0; i < nslow; i++)
     {
-        vector_free_str(logcmds);
-        vector_delete(logcmds);
-        string_delete(cmdnewl);
-        return;   
+        HistoryRecord rec = history_record(h, slowest[i]);
+        log_format_us(wall, sizeof(wall), rec->wall);
+        log_format_us(user, sizeof(user), rec->user);
+        log_format_us(sys, sizeof(sys), rec->sys);
+        printf("%10s (user %s, sys %s)  %.*s\n", wall, user, sys, (int)rec->len, rec->text);
     }
-    vector_append(logcmds, cmdnewl);
 
-    String logfile = string_create_copyc("/.yash_log");
-    String logfile_path = string_add(sd->home_dir_path, logfile);
-    FILE* logf = fopen(string_get_cstr(logfile_path), "w");
+    LogStat* byfreq = malloc(sizeof(LogStat) * (used ? used : 1));
+    size_t nfreq = 0;
+    for (size_t k = 0; k < cap; k++)
+        if (table[k].name)
+            byfreq[nfreq++] = &table[k];
+    qsort(byfreq, nfreq, sizeof(LogStat), log_stats_cmp);
 
-    int start = (logcmds->len == 16) ? 1 : 0;
-    for (; start< logcmds->len; start++)
-        fprintf(logf, "%s", string_get_cstr(logcmds->data[start]));
-    
-    fclose(logf);
-    
-    string_delete(logfile);
-    string_delete(logfile_path);
-    vector_free_str(logcmds);
-    vector_delete(logcmds);
+    char p50[32], p99[32], mean[32];
+    printf("Most frequent commands:\n%8s %10s %10s %10s  %s\n", "count", "mean", "p50", "p99", "name");
+    for (size_t i = 0; i < nfreq && i < LOG_STATS_TOP; i++)
+    {
+        LogStat st = byfreq[i];
+        log_format_us(mean, sizeof(mean), st->total / st->count);
+        log_format_us(p50, sizeof(p50), log_stats_percentile(st, 0.50));
+        log_format_us(p99, sizeof(p99), log_stats_percentile(st, 0.99));
+        printf("%8lu %10s %10s %10s  %.*s\n", st->count, mean, p50, p99, (int)st->namelen, st->name);
+    }
+
+    free(byfreq);
+    free(table);
 }
 
 char* seek_searchname, *seek_last_found;
@@ -299,11 +474,11 @@ int find(const char* fpath, const struct stat* sb, int typeflag, struct FTW* ftw
     return FTW_CONTINUE;
 }
 
-void find_init(String target, String searchdir) {
+void find_init(char* target, String searchdir) {
     seek_num_results = 0;
     seek_last_found = NULL;
-    seek_searchname = target->cstr;
-    seek_searchname_len = string_get_strlen(target);
+    seek_searchname = target;
+    seek_searchname_len = strlen(target);
     seek_searchdir_len = string_get_strlen(searchdir);
 }
 
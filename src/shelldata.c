@@ -8,16 +8,30 @@
 #include "prompt.h"
 #include "jobctrl.h"
 #include "mystring.h"
+#include "linereader.h"
+#include "shellcmdutils.h"
+#include "history.h"
+#include "cmdhash.h"
 
 ShellData shelldata_create() {
     ShellData sd = malloc(sizeof(st_ShellData));
     sd->home_dir_path = NULL;
     sd->prev_command = NULL;
     sd->prev_path = NULL;
+    sd->history = NULL;
+    sd->cmds = cmdhash_create();
+    sd->prompt = NULL;
+    sd->prompt_ident = NULL;
+    sd->cwd = NULL;
     sd->shell_tmodes = malloc(sizeof(struct termios));
     sd->shell_terminal = -1;
     sd->shell_pgid = -1;
     sd->jobs = joblist_create();
+    sd->reader = NULL;
+    sd->interactive = false;
+    sd->bg_pinned = false;
+    sd->bg_demote = true;
+    sd->bg_nice = JOB_DEMOTE_NICE;
     return sd;
 }
 
@@ -28,17 +42,37 @@ void shelldata_delete(ShellData sd) {
         string_delete(sd->prev_command);
     if (sd->prev_path)
         string_delete(sd->prev_path);
+    history_close(sd->history);
+    cmdhash_delete(sd->cmds);
+    if (sd->prompt)
+        string_delete(sd->prompt);
+    if (sd->prompt_ident)
+        string_delete(sd->prompt_ident);
+    if (sd->cwd)
+        string_delete(sd->cwd);
     free(sd->shell_tmodes);
     joblist_delete(sd->jobs, true);
+    if (sd->reader)
+        linereader_delete(sd->reader);
     free(sd);
 }
 
-ShellData init_shell() {
+ShellData init_shell(LineReader reader, bool_t interactive) {
     ShellData sd = shelldata_create();
     sd->home_dir_path = get_path();
     sd->prev_path = get_path();
-    sd->prev_command = string_create(NULL, 0);
+    sd->prev_command = NULL;
     sd->shell_terminal = STDIN_FILENO;
+    sd->reader = reader;
+    sd->interactive = interactive;
+    sd->shell_pgid = getpgrp();
+    jobctrl_init_reaper();
+
+    // Scripts and pipes don't own the terminal, so skip job control setup.
+    if (!interactive)
+        return sd;
+
+    log_open(sd);
 
     while (get_terminal_pgrp(sd->shell_terminal) != (sd->shell_pgid = getpgrp()))
         kill(-sd->shell_pgid, SIGTTIN);
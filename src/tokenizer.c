@@ -0,0 +1,211 @@
+#include "tokenizer.h"
+#include "parser.h"
+
+/*
+Splits a command line into tokens without copying it.
+Each token is a (type, offset, length) span into the buffer handed to
+tokenizer_init, and the buffer itself is never modified, so callers are free
+to NUL-terminate spans in place once the line has been fully parsed.
+*/
+
+static bool_t is_delimiter(char c) {
+    return (c == '|' ||\
+            c == ';' ||\
+            c == '&' ||\
+            c == '>' ||\
+            c == '<');
+}
+
+static size_t scan_whitespace_scalar(const char* buf, size_t pos, size_t stop) {
+    while (pos < stop && is_whitespace(buf[pos]))
+        pos++;
+    return pos;
+}
+
+static size_t scan_word_scalar(const char* buf, size_t pos, size_t stop) {
+    while (pos < stop && !is_delimiter(buf[pos]) && !is_whitespace(buf[pos]))
+        pos++;
+    return pos;
+}
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+
+/*
+Vectorized scanners. Each block is compared against every whitespace and
+delimiter byte, the comparison masks are OR'ed together and movemask gives a
+bitmap of "interesting" bytes, so the first hit is a single ctz away. Only
+whole blocks inside [pos, stop) are loaded; the tail goes through the scalar
+loop.
+*/
+
+static inline __m128i classify_ws_sse2(__m128i v) {
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\v')));
+}
+
+static inline __m128i classify_delim_sse2(__m128i v) {
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8('|'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+}
+
+static size_t scan_whitespace_sse2(const char* buf, size_t pos, size_t stop) {
+    while (pos + 16 <= stop)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + pos));
+        unsigned int mask = ~_mm_movemask_epi8(classify_ws_sse2(v)) & 0xFFFF;
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return scan_whitespace_scalar(buf, pos, stop);
+}
+
+static size_t scan_word_sse2(const char* buf, size_t pos, size_t stop) {
+    while (pos + 16 <= stop)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + pos));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(classify_ws_sse2(v), classify_delim_sse2(v)));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+    return scan_word_scalar(buf, pos, stop);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i classify_ws_avx2(__m256i v) {
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\v')));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i classify_delim_avx2(__m256i v) {
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|'));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_whitespace_avx2(const char* buf, size_t pos, size_t stop) {
+    while (pos + 32 <= stop)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + pos));
+        unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(classify_ws_avx2(v));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return scan_whitespace_sse2(buf, pos, stop);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_word_avx2(const char* buf, size_t pos, size_t stop) {
+    while (pos + 32 <= stop)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + pos));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(classify_ws_avx2(v), classify_delim_avx2(v)));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+        pos += 32;
+    }
+    return scan_word_sse2(buf, pos, stop);
+}
+#endif
+
+typedef size_t (*scan_func)(const char*, size_t, size_t);
+
+static scan_func scan_whitespace_impl = NULL;
+static scan_func scan_word_impl = NULL;
+
+// Picks the widest scanner the running CPU supports, once.
+static void scan_select_impl() {
+    scan_whitespace_impl = scan_whitespace_scalar;
+    scan_word_impl = scan_word_scalar;
+#if defined(__SSE2__)
+    scan_whitespace_impl = scan_whitespace_sse2;
+    scan_word_impl = scan_word_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_whitespace_impl = scan_whitespace_avx2;
+        scan_word_impl = scan_word_avx2;
+    }
+#endif
+}
+
+size_t scan_whitespace(const char* buf, size_t pos, size_t stop) {
+    if (!scan_whitespace_impl)
+        scan_select_impl();
+    return scan_whitespace_impl(buf, pos, stop);
+}
+
+size_t scan_word(const char* buf, size_t pos, size_t stop) {
+    if (!scan_word_impl)
+        scan_select_impl();
+    return scan_word_impl(buf, pos, stop);
+}
+
+void tokenizer_init(Tokenizer tz, char* buf, size_t len) {
+    tz->buf = buf;
+    tz->len = len;
+    tz->pos = 0;
+    tz->prev_end = 0;
+    tz->curr.type = TOK_END;
+    tz->curr.off = 0;
+    tz->curr.len = 0;
+    tokenizer_next(tz);
+}
+
+Token tokenizer_peek(Tokenizer tz) {
+    return &tz->curr;
+}
+
+void tokenizer_next(Tokenizer tz) {
+    Token tok = &tz->curr;
+    if (tok->type != TOK_END)
+        tz->prev_end = tok->off + tok->len;
+
+    size_t iter = scan_whitespace(tz->buf, tz->pos, tz->len);
+    tok->off = iter;
+    tok->len = 1;
+    if (iter == tz->len)
+    {
+        tok->type = TOK_END;
+        tok->len = 0;
+    }
+    else if (tz->buf[iter] == '|')
+        tok->type = TOK_PIPE;
+    else if (tz->buf[iter] == ';')
+        tok->type = TOK_SEMI;
+    else if (tz->buf[iter] == '&')
+        tok->type = TOK_AMP;
+    else if (tz->buf[iter] == '<')
+        tok->type = TOK_IN;
+    else if (tz->buf[iter] == '>')
+    {
+        tok->type = TOK_OUT;
+        if (iter+1 < tz->len && tz->buf[iter+1] == '>')
+        {
+            tok->type = TOK_APPEND;
+            tok->len = 2;
+        }
+    }
+    else
+    {
+        tok->type = TOK_WORD;
+        tok->len = scan_word(tz->buf, iter, tz->len) - iter;
+    }
+    tz->pos = tok->off + tok->len;
+}
\ No newline at end of file
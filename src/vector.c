@@ -1,7 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "vector.h"
 #include "mystring.h"
+#include "arena.h"
 
 Vector vector_create(size_t buflen) {
     Vector v = malloc(sizeof(st_Vector));
@@ -11,6 +13,16 @@ Vector vector_create(size_t buflen) {
     return v;
 }
 
+// Exact-size copy of src carved from a, for vectors that no longer grow.
+Vector vector_create_arena(Arena a, Vector src) {
+    Vector v = arena_alloc(a, sizeof(st_Vector));
+    v->buflen = src->len;
+    v->len = src->len;
+    v->data = arena_alloc(a, sizeof(void*)*(v->buflen ? v->buflen : 1));
+    memcpy(v->data, src->data, sizeof(void*)*src->len);
+    return v;
+}
+
 void vector_append(Vector v, void* data) {
     if (v->len == v->buflen)
     {
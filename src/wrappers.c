@@ -30,16 +30,4 @@ errcode_t wrap_getcwd(char* buf, size_t buflen) {
     if (!ret)
         return -1;
     return 0;
-}
-
-errcode_t wrap_fgets(char* buf, size_t buflen) {
-    char* ret = fgets(buf, buflen, stdin);
-    if (!ret){
-        if (feof(stdin))
-            return -2;
-        else
-            return -1;
-    }
-
-    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "history.h"
+
+/*
+Stress test for the shared history log: WRITERS processes open the same file
+and append ENTRIES records each at once. Every record must then be found
+exactly once by walking the log backwards, and the header count must agree.
+Then a torn record is left at the end of the file, as a crash would leave
+it, and reopening must drop it and keep appending where the last whole
+record ended.
+*/
+
+#define WRITERS 8
+#define ENTRIES 2000
+
+static int fail(const char* msg) {
+    fprintf(stderr, "FAIL: %s\n", msg);
+    return 1;
+}
+
+static void writer(const char* path, int w) {
+    History h = history_open(path);
+    if (!h)
+        _exit(EXIT_FAILURE);
+    char cmd[64];
+    const char* cwd = "/tmp";
+    for (int i = 0; i < ENTRIES; i++)
+    {
+        st_HistoryRecord meta = {0};
+        meta.start = i;
+        // Lengths vary so the records are not all the same size.
+        int len = snprintf(cmd, sizeof(cmd), "echo %d %d %.*s", w, i, i % 17, "xxxxxxxxxxxxxxxxx");
+        history_append(h, &meta, cmd, len, cwd, strlen(cwd));
+    }
+    history_close(h);
+    _exit(EXIT_SUCCESS);
+}
+
+// Walks the log from its end and checks every writer's entries are there
+// exactly once. Returns the number of records seen, or -1.
+static long check_all(History h, unsigned char* seen) {
+    long n = 0;
+    memset(seen, 0, WRITERS * ENTRIES);
+    for (uint64_t off = history_prev(h, history_end(h)); off != 0; off = history_prev(h, off))
+    {
+        size_t len;
+        char* text = history_text(h, off, &len);
+        char buf[64];
+        int w, i;
+        if (len >= sizeof(buf))
+            return -1;
+        memcpy(buf, text, len);
+        buf[len] = '\0';
+        if (sscanf(buf, "echo %d %d", &w, &i) != 2 || w < 0 || w >= WRITERS || i < 0 || i >= ENTRIES)
+            continue;
+        if (seen[w * ENTRIES + i]++)
+        {
+            fprintf(stderr, "FAIL: duplicate entry %s\n", buf);
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+int main() {
+    char path[] = "/tmp/yash_history_testXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return fail("mkstemp");
+    close(fd);
+    char idxpath[sizeof(path) + 4];
+    snprintf(idxpath, sizeof(idxpath), "%s.idx", path);
+
+    for (int w = 0; w < WRITERS; w++)
+        if (fork() == 0)
+            writer(path, w);
+    int status, failed = 0;
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = fail("a writer could not open the log");
+
+    unsigned char* seen = malloc(WRITERS * ENTRIES);
+    History h = history_open(path);
+    if (!h)
+        return fail("history_open");
+    long n = check_all(h, seen);
+    printf("%ld of %d entries from %d writers\n", n, WRITERS * ENTRIES, WRITERS);
+    if (n != WRITERS * ENTRIES)
+        failed = fail("entries were lost");
+    if (history_count(h) != WRITERS * ENTRIES)
+        failed = fail("header count does not match");
+    history_close(h);
+
+    // Half of a record's header, as a crash mid-append would leave it.
+    fd = open(path, O_WRONLY | O_APPEND);
+    st_HistoryRecord torn = {48, 5};
+    if (fd < 0 || write(fd, &torn, 12) != 12)
+        return fail("could not tear the log");
+    close(fd);
+
+    h = history_open(path);
+    if (!h)
+        return fail("history_open after a torn record");
+    st_HistoryRecord meta = {0};
+    history_append(h, &meta, "echo after", 10, "/tmp", 4);
+    size_t len;
+    char* text = history_get(h, 1, &len);
+    if (!text || len != 10 || memcmp(text, "echo after", 10) != 0)
+        failed = fail("the record after a torn one cannot be read");
+    else if (check_all(h, seen) != WRITERS * ENTRIES)
+        failed = fail("records before a torn one were lost");
+    history_close(h);
+
+    unlink(path);
+    unlink(idxpath);
+    free(seen);
+    if (!failed)
+        printf("PASS\n");
+    return failed;
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parser.h"
+#include "jobctrl.h"
+#include "mystring.h"
+#include "vector.h"
+#include "arena.h"
+
+/*
+Regression test for the per-line arena: parsing a line, building every argv
+and freeing the jobs again must cost a handful of mallocs, however many
+words, redirects and pipeline stages the line has. Linked with
+-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so only the shell's own
+calls are counted.
+*/
+
+#define MAX_ALLOCS_PER_LINE 8
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static size_t nallocs = 0;
+
+void* __wrap_malloc(size_t size) {
+    nallocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+    nallocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    nallocs++;
+    return __real_realloc(ptr, size);
+}
+
+// Runs one line through the parse -> argv -> delete lifecycle and returns
+// the number of allocations it took.
+static size_t count_line(const char* line) {
+    String input = string_create_copyc((char*)line);
+    size_t before = nallocs;
+
+    JobList jl = joblist_create();
+    jl->arena = arena_create(ARENA_BLOCK_SIZE + string_get_strlen(input) * 4);
+    if (parse_line(jl, input) != 0)
+    {
+        fprintf(stderr, "FAIL: could not parse \"%s\"\n", line);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < jl->nslots; i++)
+    {
+        Job j = jl->slots[i];
+        for (int k = 0; j && k < j->procs->len; k++)
+            process_get_argv((Process)j->procs->data[k]);
+    }
+    joblist_delete(jl, true);
+
+    size_t used = nallocs - before;
+    string_delete(input);
+    return used;
+}
+
+int main() {
+    static const char* lines[] = {
+        "ls",
+        "ls -l -a /tmp",
+        "cat < in.txt | sort -r | uniq -c | head -n 20 > out.txt",
+        "echo a b c d e f g h i j k l m n o p q r s t u v w x y z a b c d e f g h i j k l m n o p",
+        "sleep 1 & sleep 2 & sleep 3 ; echo one ; echo two ; echo three >> log.txt",
+    };
+    size_t nlines = sizeof(lines) / sizeof(lines[0]);
+
+    // The parser keeps a scratch vector across lines, so warm it up first.
+    for (size_t i = 0; i < nlines; i++)
+        count_line(lines[i]);
+
+    int failed = 0;
+    for (size_t i = 0; i < nlines; i++)
+    {
+        size_t used = count_line(lines[i]);
+        printf("%3zu allocations: %s\n", used, lines[i]);
+        if (used > MAX_ALLOCS_PER_LINE)
+        {
+            fprintf(stderr, "FAIL: %zu allocations, expected at most %d\n", used, MAX_ALLOCS_PER_LINE);
+            failed = 1;
+        }
+    }
+    if (!failed)
+        printf("PASS\n");
+    return failed;
+}